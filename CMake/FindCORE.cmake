@@ -68,12 +68,13 @@ find_library(CORE_LIBRARY_MDS NAMES mds)
 find_library(CORE_LIBRARY_MTH NAMES mth)
 find_library(CORE_LIBRARY_PARM NAMES parma)
 find_library(CORE_LIBRARY_PCU NAMES pcu)
+find_library(CORE_LIBRARY_PUMI NAMES pumi)
 
 #get_filename_component(CORE_LIB_DIR ${CORE_LIBRARY} DIRECTORY)
 
 # Checks 'REQUIRED', 'QUIET' and versions.
 include(FindPackageHandleStandardArgs)
-list(APPEND CORE_LIBRARIES ${CORE_LIBRARY_PCU}
+list(APPEND CORE_LIBRARIES ${CORE_LIBRARY_PUMI} ${CORE_LIBRARY_PCU}
     ${CORE_LIBRARY_GMI} ${CORE_LIBRARY_MDS} ${CORE_LIBRARY_APF}
     ${CORE_LIBRARY_APF_ZOLTAN} ${CORE_LIBRARY_MA} ${CORE_LIBRARY_PARMA}
     ${CORE_LIBRARY_LION} ${CORE_LIBRARY_MTH})
@@ -1,36 +1,118 @@
 #include "app.h"
 #include "linsys.h"
 #include "utils.h"
+#include "memory.h"
+#include "perf.h"
+#include <apfNumbering.h>
 #include <PCU.h>
 
 namespace pe {
 
-App::App(apf::Mesh* m, 
+App::App(apf::Mesh2* m, 
         int pol_o, 
         int integr_o, 
         std::function<BoundaryType(apf::Vector3 const&)> bd_cond,  
-        std::function<double(apf::Vector3 const&)> neu_fun,  
-        std::function<double(apf::Vector3 const&)> dir_fun, 
-        std::function<double(apf::Vector3 const&)> rhs_fun, 
+        ScalarFunction neu_fun,  
+        ScalarFunction dir_fun, 
+        ScalarFunction rhs_fun, 
         const char* out_name) :
   mesh(m),
+  sol(0),
+  owned(0),
+  shared(0),
+  lean(false),
+  ownerComputes(false),
+  updatable(false),
   polynomialOrder(pol_o),
   integrationOrder(integr_o),
+  linsys(0),
+  locator(0),
   bd_condition(bd_cond),
   g_neu(neu_fun),
   g_dir(dir_fun),
   rhs(rhs_fun),
   out(out_name)
 {
+  timings.assemble = timings.solve = timings.output = 0;
+  timings.iterations = 0;
   print("solvifying poisson's equation!");
 }
 
+// the lean mode keeps no numbering once the system is assembled
+void App::freeNumbering()
+{
+  recordMemory("numberings freed",
+      -getNumberingBytes(mesh, apf::getShape(sol)));
+  apf::destroyGlobalNumbering(shared);
+  shared = 0;
+}
+
+// Keep a copy of the volume system so that update() only has to redo the
+// boundary conditions. Must be called before run(), which is also where
+// the lean mode would free the numbering that updates need.
+void App::enableUpdates()
+{
+  if (getBoolOption("-pe_lean_numbering"))
+    fail("updates need the numbering, drop -pe_lean_numbering");
+  updatable = true;
+}
+
 void App::run()
 {
   pre();
+  PerfSample s0 = readCounters();
   assemble();
+  recordPerf(PERF_ASSEMBLE, s0);
+  if (lean)
+    freeNumbering();
+  s0 = readCounters();
+  linsys->solve();
+  recordPerf(PERF_SOLVE, s0);
+  if (getBoolOption("-pe_memory_report"))
+  {
+    linsys->printMatrixUsage();
+    printMemoryReport();
+  }
+  if (perfEnabled())
+  {
+    measureAssembly();
+    linsys->measureMatMult(50);
+    printPerfReport();
+  }
+  post();
+}
+
+// Solve again with new boundary data, the mesh, orders and PDE staying
+// the same. The preconditioner is reused if the Dirichlet rows are.
+void App::update(
+    std::function<BoundaryType(apf::Vector3 const&)> bd_cond,
+    ScalarFunction neu_fun,
+    ScalarFunction dir_fun,
+    const char* out_name)
+{
+  if ( ! updatable)
+    fail("App::enableUpdates must be called before App::run");
+  ASSERT(shared);
+  bd_condition = bd_cond;
+  g_neu = neu_fun;
+  g_dir = dir_fun;
+  out = out_name;
+  double t0 = PCU_Time();
+  reassemble();
+  double t1 = PCU_Time();
   linsys->solve();
+  double t2 = PCU_Time();
   post();
+  double t3 = PCU_Time();
+  timings.assemble = t1-t0;
+  timings.solve = t2-t1;
+  timings.output = t3-t2;
+  timings.iterations = linsys->getIterations();
+}
+
+App::Timings const& App::getTimings() const
+{
+  return timings;
 }
 
 }
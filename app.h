@@ -2,10 +2,14 @@
 #define PE_APP_H
 
 #include "bd_cond.h"
+#include "function.h"
 #include <functional>
+#include <string>
+#include <vector>
 
 namespace apf {
 class Mesh;
+class Mesh2;
 class Field;
 class Vector3;
 template <class T> class NumberingOf;
@@ -15,43 +19,70 @@ typedef NumberingOf<long> GlobalNumbering;
 namespace pe {
 
 class LinSys;
+class PointLocator;
 
 class App
 {
   public:
 
-    App(apf::Mesh* m, 
+    App(apf::Mesh2* m, 
         int pol_o, 
         int integr_o, 
         std::function<BoundaryType(apf::Vector3 const&)> bd_cond,  
-        std::function<double(apf::Vector3 const&)> neu_fun,  
-        std::function<double(apf::Vector3 const&)> dir_fun, 
-        std::function<double(apf::Vector3 const&)> rhs_fun, 
+        ScalarFunction neu_fun,  
+        ScalarFunction dir_fun, 
+        ScalarFunction rhs_fun, 
         const char* out_name);
+    ~App();
+    void enableUpdates();
     void run();
+    void update(
+        std::function<BoundaryType(apf::Vector3 const&)> bd_cond,
+        ScalarFunction neu_fun,
+        ScalarFunction dir_fun,
+        const char* out_name);
+    void setSource(ScalarFunction rhs_fun);
+    /* wall clock seconds spent by the last update() */
+    struct Timings
+    {
+      double assemble;
+      double solve;
+      double output;
+      int iterations;
+    };
+    Timings const& getTimings() const;
 
   private:
 
     void pre();
     void assemble();
+    void reassemble();
+    void measureAssembly();
     void post();
+    void freeNumbering();
 
-    apf::Mesh* mesh;
+    apf::Mesh2* mesh;
     apf::Field* sol;
     apf::GlobalNumbering* owned;
     apf::GlobalNumbering* shared;
+    bool lean;
+    bool ownerComputes;
+    bool updatable;
+    std::vector<long> dirRows;
+    Timings timings;
 
     int polynomialOrder;
     int integrationOrder;
 
     LinSys* linsys;
+    PointLocator* locator;
 
     std::function<BoundaryType(apf::Vector3 const&)> bd_condition;
-    std::function<double(apf::Vector3 const&)> g_neu;
-    std::function<double(apf::Vector3 const&)> g_dir;
-    std::function<double(apf::Vector3 const&)> rhs;
+    ScalarFunction g_neu;
+    ScalarFunction g_dir;
+    ScalarFunction rhs;
 
-    const char* out;
+    std::string out;
 };
 
 }
@@ -3,7 +3,10 @@
 #include "linsys.h"
 #include "integrate.h"
 #include "bd_cond.h"
+#include "ghost.h"
+#include "perf.h"
 #include <apf.h>
+#include <apfMesh2.h>
 #include <apfNumbering.h>
 #include <apfDynamicVector.h>
 #include <apfDynamicMatrix.h>
@@ -13,6 +16,8 @@
 #include <functional>
 #include <mpi.h>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <cassert>
 namespace pe {
 
@@ -27,6 +32,14 @@ static void addToRHS(
   ls->addToVector(sz, &numbers[0], &fe[0]);
 }
 
+// the additions of an element system to the global one, for the perf
+// report; the vector only, or the matrix as well
+static double countScatter(apf::DynamicVector const& fe, bool matrix)
+{
+  double sz = fe.getSize();
+  return matrix ? sz * (sz + 1) : sz;
+}
+
 static void addToSystem(
     apf::DynamicVector& fe,
     apf::DynamicMatrix& ke,
@@ -40,51 +53,204 @@ static void addToSystem(
   ls->addToMatrix(sz, &numbers[0], &ke(0,0));
 }
 
-// Assemble Linear System, according to the PDE inside the domain
-static void assembleSystem(
+// True if e has a node on an entity shared with another part, i.e. if
+// its contributions may belong to off-process rows
+static bool touchesPartBoundary(
+    apf::Mesh* m,
+    apf::MeshEntity* e,
+    apf::FieldShape* s)
+{
+  int D = apf::getDimension(m, e);
+  for (int d=0; d <= D; ++d)
+    if (s->hasNodesIn(d))
+    {
+      apf::Downward de;
+      int nde = m->getDownward(e,d,de);
+      for (int i=0; i < nde; ++i)
+        if (m->isShared(de[i]))
+          return true;
+    }
+  return false;
+}
+
+// Element contributions computed while the off-process exchange is in
+// flight. PETSc does not allow insertion between AssemblyBegin and
+// AssemblyEnd, so they are held here and inserted afterwards.
+class ElementBuffer
+{
+  public:
+    void add(apf::DynamicVector& fe, apf::DynamicMatrix& ke,
+        apf::MeshEntity* e, apf::GlobalNumbering* n)
+    {
+      apf::NewArray<long> nums;
+      int sz = apf::getElementNumbers(n, e, nums);
+      sizes.push_back(sz);
+      numbers.insert(numbers.end(), &nums[0], &nums[0] + sz);
+      vectors.insert(vectors.end(), &fe[0], &fe[0] + sz);
+      matrices.insert(matrices.end(), &ke(0,0), &ke(0,0) + sz*sz);
+    }
+    // returns the number of values added
+    std::size_t flush(LinSys* ls)
+    {
+      std::size_t v = 0, k = 0;
+      for (std::size_t i=0; i < sizes.size(); ++i)
+      {
+        int sz = sizes[i];
+        ls->addToVector(sz, &numbers[v], &vectors[v]);
+        ls->addToMatrix(sz, &numbers[v], &matrices[k]);
+        v += sz;
+        k += sz*sz;
+      }
+      return v + k;
+    }
+  private:
+    std::vector<int> sizes;
+    std::vector<long> numbers;
+    std::vector<double> vectors;
+    std::vector<double> matrices;
+};
+
+// Assemble Linear System, according to the PDE inside the domain.
+// Elements on the part boundary go first so that their off-process
+// contributions travel while the interior elements are integrated.
+// At most one interior element per boundary element is buffered
+// during the exchange (and never fewer than minOverlap), the rest
+// is inserted directly once it has completed. Returns the bytes this part
+// sent through the off-process stash.
+static double assembleSystem(
+    int o,
+    apf::Mesh* m,
+    apf::Field* f,
+    ScalarFunction rhs,
+    apf::GlobalNumbering* n,
+    LinSys* ls)
+{
+  const std::size_t minOverlap = 1024;
+  Integrate integrate(o, f, rhs);
+  apf::FieldShape* s = apf::getShape(f);
+  double scattered = 0;
+  std::vector<apf::MeshEntity*> boundary;
+  std::vector<apf::MeshEntity*> interior;
+  apf::MeshEntity* elem;
+  apf::MeshIterator* elems = m->begin(m->getDimension());
+  while ((elem = m->iterate(elems)))
+    if (touchesPartBoundary(m, elem, s))
+      boundary.push_back(elem);
+    else
+      interior.push_back(elem);
+  m->end(elems);
+  integrateInBlocks(integrate, m, boundary.data(), boundary.size(),
+      [&](std::size_t i) {
+    addToSystem(integrate.fe, integrate.ke, boundary[i], n, ls);
+    scattered += countScatter(integrate.fe, true);
+  });
+  double stashed = ls->getStashBytes();
+  ls->beginSynchronize();
+  std::size_t noverlap = std::min(interior.size(),
+      std::max(boundary.size(), minOverlap));
+  ElementBuffer buffer;
+  integrateInBlocks(integrate, m, interior.data(), noverlap,
+      [&](std::size_t i) {
+    buffer.add(integrate.fe, integrate.ke, interior[i], n);
+    scattered += countScatter(integrate.fe, true);
+  });
+  ls->endSynchronize();
+  buffer.flush(ls);
+  apf::MeshEntity* const* rest = interior.data() + noverlap;
+  integrateInBlocks(integrate, m, rest, interior.size() - noverlap,
+      [&](std::size_t i) {
+    addToSystem(integrate.fe, integrate.ke, rest[i], n, ls);
+    scattered += countScatter(integrate.fe, true);
+  });
+  ls->synchronize();
+  countFlops(integrate.flops + scattered);
+  return stashed;
+}
+
+// Assemble Linear System, owner-computes variant. With a ghost layer every
+// element touching an owned node is on this part, so the rows of owned
+// nodes are complete here and the rows of other nodes are dropped (PETSc
+// ignores negative indices). Nothing should go through the off-process
+// stash, the bytes that did are returned.
+static double assembleOwnedRows(
     int o,
     apf::Mesh* m,
     apf::Field* f,
-    std::function<double(apf::Vector3 const&)> rhs,
+    ScalarFunction rhs,
     apf::GlobalNumbering* n,
     LinSys* ls)
 {
   Integrate integrate(o, f, rhs);
+  long first, last;
+  ls->getOwnedRange(first, last);
+  ls->disableOffProcEntries();
+  std::vector<apf::MeshEntity*> elements;
   apf::MeshEntity* elem;
   apf::MeshIterator* elems = m->begin(m->getDimension());
   while ((elem = m->iterate(elems)))
   {
-    apf::MeshElement* me = apf::createMeshElement(m, elem);
-    integrate.process(me);
-    addToSystem(integrate.fe, integrate.ke, elem, n, ls);
-    apf::destroyMeshElement(me);
+    apf::NewArray<long> cols;
+    int sz = apf::getElementNumbers(n, elem, cols);
+    for (int i=0; i < sz; ++i)
+      if (cols[i] >= first && cols[i] < last)
+      {
+        elements.push_back(elem);
+        break;
+      }
   }
   m->end(elems);
+  std::vector<long> rows;
+  double scattered = 0;
+  integrateInBlocks(integrate, m, elements.data(), elements.size(),
+      [&](std::size_t e) {
+    apf::NewArray<long> cols;
+    int sz = apf::getElementNumbers(n, elements[e], cols);
+    rows.assign(&cols[0], &cols[0] + sz);
+    for (int i=0; i < sz; ++i)
+      if (rows[i] < first || rows[i] >= last)
+        rows[i] = -1;
+    ls->addToVector(sz, &rows[0], &integrate.fe[0]);
+    ls->addToMatrix(sz, &rows[0], sz, &cols[0], &integrate.ke(0,0));
+    scattered += countScatter(integrate.fe, true);
+  });
+  countFlops(integrate.flops + scattered);
+  double stashed = ls->getStashBytes();
   ls->synchronize();
+  return stashed;
 }
 
 
-// Modify Linear System, enforcing Dirichlet boundary conditions
-static void applyDirBC(
+// Rows constrained by Dirichlet boundary conditions, and their values
+static void getDirRows(
     apf::Mesh* m,
     apf::Field* f,
     apf::GlobalNumbering* gn,
     std::function<BoundaryType(apf::Vector3 const&)> bd_condition,
-    std::function<double(apf::Vector3 const&)> g_dir,
-    LinSys* ls)
+    ScalarFunction g_dir,
+    std::vector<long>& v_rows,
+    std::vector<double>& v_vals)
 {
     auto vec_dir_nodes = getDirNodes(m, apf::getShape(f), bd_condition);
     size_t n_nodes = vec_dir_nodes.size();
-    std::vector<long>   v_rows; v_rows.reserve(n_nodes);
-    std::vector<double> v_vals; v_vals.reserve(n_nodes);
-    apf::Vector3 p;
-    for (auto&& nd : vec_dir_nodes) {
-        m->getPoint(nd.entity, nd.node, p);
-        v_vals.push_back(g_dir(p)); 
-        v_rows.push_back(apf::getNumber(gn, nd));  
+    v_rows.resize(n_nodes);
+    v_vals.resize(n_nodes);
+    std::vector<apf::Vector3> v_pts(n_nodes);
+    for (size_t i = 0; i < n_nodes; ++i) {
+        m->getPoint(vec_dir_nodes[i].entity, vec_dir_nodes[i].node, v_pts[i]);
+        v_rows[i] = apf::getNumber(gn, vec_dir_nodes[i]);
     }
-    ls->diagMatRow(n_nodes, &v_rows[0]);
-    ls->setToVector(n_nodes, &v_rows[0], &v_vals[0]);
+    if (n_nodes)
+        g_dir.evaluate(n_nodes, &v_pts[0], &v_vals[0]);
+}
+
+// Modify Linear System, enforcing Dirichlet boundary conditions
+static void applyDirBC(
+    std::vector<long>& v_rows,
+    std::vector<double>& v_vals,
+    LinSys* ls)
+{
+    ls->diagMatRow(v_rows.size(), v_rows.data());
+    ls->setToVector(v_rows.size(), v_rows.data(), v_vals.data());
     ls->synchronize();
 }
 
@@ -96,43 +262,151 @@ static void applyNeuBC(
     apf::Field* f,
     apf::GlobalNumbering* gn,
     std::function<BoundaryType(apf::Vector3 const&)> bd_condition,
-    std::function<double(apf::Vector3 const&)> g_neu,
+    ScalarFunction g_neu,
     LinSys* ls)
 {
     IntegrateNeuBC integrate_neu_bc(integr_ord, f, g_neu);
     apf::FieldShape* f_sh = apf::getShape(f);
     auto vec_neu_ents = getNeuMeshEntities(m, bd_condition);
-    for (auto&& mesh_ent : vec_neu_ents) {
-        apf::MeshElement* mesh_el = apf::createMeshElement(m, mesh_ent);
-        integrate_neu_bc.process(mesh_el);
-        addToRHS(integrate_neu_bc.fe, mesh_ent, gn, ls);                     
-        apf::destroyMeshElement(mesh_el);
-    }
+    double scattered = 0;
+    integrateInBlocks(integrate_neu_bc, m, vec_neu_ents.data(),
+        vec_neu_ents.size(), [&](std::size_t i) {
+        addToRHS(integrate_neu_bc.fe, vec_neu_ents[i], gn, ls);
+        scattered += countScatter(integrate_neu_bc.fe, false);
+    });
+    countFlops(integrate_neu_bc.flops + scattered);
     ls->synchronize();
 }
 
-static void applyBCToSystem(
-    apf::Mesh* m,
-    apf::GlobalNumbering* gn,
-    apf::Field* f,
-    std::function<BoundaryType(apf::Vector3 const&)> bd_condition,
-    std::function<double(apf::Vector3 const&)> g_neu,
-    std::function<double(apf::Vector3 const&)> g_dir,
-    LinSys* ls)
+void App::assemble()
 {
-    int integr_ord = 1;
-    applyNeuBC(integr_ord, m, f, gn, bd_condition, g_neu, ls);
-    applyDirBC(m,f,gn, bd_condition, g_dir, ls);
+  double t0 = PCU_Time();
+  // bytes sent by this part, only reduced once assembly is over so that
+  // the reductions do not hold up the exchanges
+  double ghosted = 0, numbers = 0, stashed;
+  if (ownerComputes)
+  {
+    // The ghost layer is added once the numbering is done, so that the
+    // ghosts own nothing and just carry numbers. Its time and traffic
+    // belong to this assembly path.
+    ghosted = createGhostLayer(mesh);
+    // Integrate builds an apf::Element on every ghost element, which reads
+    // u at all of its nodes. Ghosting does not promise to bring field data
+    // along, and reading a tag the new entities lack fails or gives
+    // garbage, so give them the zero every node already holds.
+    apf::zeroField(sol);
+    numbers = synchronizeGhostNumbers(mesh, apf::getShape(sol), shared);
+    stashed = assembleOwnedRows(integrationOrder, mesh, sol, rhs, shared,
+        linsys);
+    destroyGhostLayer(mesh);
+  }
+  else
+    stashed = assembleSystem(integrationOrder, mesh, sol, rhs, shared,
+        linsys);
+  print("volume assembled in %f seconds", PCU_Time()-t0);
+  if (getBoolOption("-pe_traffic"))
+  {
+    if (ownerComputes)
+    {
+      printTraffic("ghost layer (estimated)", ghosted);
+      printTraffic("ghost numbers", numbers);
+    }
+    printTraffic("off-process stash", stashed);
+  }
+  if (updatable)
+    linsys->saveVolumeSystem();
+  std::vector<double> dirValues;
+  getDirRows(mesh, sol, shared, bd_condition, g_dir, dirRows, dirValues);
+  applyNeuBC(integrationOrder, mesh, sol, shared, bd_condition, g_neu, linsys);
+  applyDirBC(dirRows, dirValues, linsys);
+  double t1 = PCU_Time();
+  print("assembled in %f seconds", t1-t0);
 }
 
-void App::assemble()
+// Start over from the saved volume system and apply the current boundary
+// data. The matrix only differs from the last one if the Dirichlet rows do.
+void App::reassemble()
 {
   double t0 = PCU_Time();
-  assembleSystem(integrationOrder, mesh, sol, rhs, shared, linsys);
+  std::vector<long> rows;
+  std::vector<double> values;
+  getDirRows(mesh, sol, shared, bd_condition, g_dir, rows, values);
+  bool same = PCU_Min_Int(rows == dirRows);
+  linsys->restoreVolumeSystem( ! same);
+  linsys->reusePreconditioner(same);
   applyNeuBC(integrationOrder, mesh, sol, shared, bd_condition, g_neu, linsys);
-  applyDirBC(mesh, sol, shared, bd_condition, g_dir, linsys);
+  applyDirBC(rows, values, linsys);
+  dirRows.swap(rows);
   double t1 = PCU_Time();
-  print("assembled in %f seconds", t1-t0);
+  print("boundary reassembled in %f seconds, %s preconditioner", t1-t0,
+      same ? "reusing the" : "rebuilding the");
+}
+
+// Integration and scatter alternate per element during assembly, and one
+// counter read costs about as much as inserting an element, so for the
+// roofline report each is measured over a whole loop: every element is
+// integrated once, then batches of stored element systems are added to a
+// scratch copy of the system. The scatter goes through the off-process
+// stash in either assembly mode, and needs the numbering.
+void App::measureAssembly()
+{
+  const std::size_t batch = 1024;
+  std::vector<apf::MeshEntity*> elements;
+  apf::MeshEntity* e;
+  apf::MeshIterator* it = mesh->begin(mesh->getDimension());
+  while ((e = mesh->iterate(it)))
+    elements.push_back(e);
+  mesh->end(it);
+  Integrate integrate(integrationOrder, sol, rhs);
+  PerfSample s0 = readCounters();
+  integrateInBlocks(integrate, mesh, elements.data(), elements.size(),
+      [](std::size_t) {});
+  recordPerf(PERF_INTEGRATE, s0, integrate.flops);
+  if ( ! shared)
+    return;
+  linsys->beginScratch();
+  for (std::size_t i=0; i < elements.size(); i += batch)
+  {
+    ElementBuffer buffer;
+    std::size_t end = std::min(elements.size(), i + batch);
+    integrateInBlocks(integrate, mesh, &elements[i], end - i,
+        [&](std::size_t j) {
+      buffer.add(integrate.fe, integrate.ke, elements[i + j], shared);
+    });
+    PerfSample s1 = readCounters();
+    std::size_t values = buffer.flush(linsys);
+    recordPerf(PERF_SCATTER, s1, double(values));
+  }
+  linsys->endScratch();
+}
+
+// Change the source term of the saved volume system. The matrix does not
+// depend on it, so only the load vector is integrated again; the next
+// update() applies the boundary data on top of it. Any ghost layer is
+// gone by now, so each element is integrated by exactly one part.
+void App::setSource(ScalarFunction rhs_fun)
+{
+  if ( ! updatable)
+    fail("App::enableUpdates must be called before App::run");
+  if ( ! shared)
+    fail("source updates need the numbering, drop -pe_lean_numbering");
+  double t0 = PCU_Time();
+  rhs = rhs_fun;
+  linsys->zeroVector();
+  IntegrateSource integrate(integrationOrder, sol, rhs);
+  std::vector<apf::MeshEntity*> elements;
+  apf::MeshEntity* e;
+  apf::MeshIterator* it = mesh->begin(mesh->getDimension());
+  while ((e = mesh->iterate(it)))
+    elements.push_back(e);
+  mesh->end(it);
+  integrateInBlocks(integrate, mesh, elements.data(), elements.size(),
+      [&](std::size_t i) {
+    addToRHS(integrate.fe, elements[i], shared, linsys);
+  });
+  linsys->synchronize();
+  linsys->saveVolumeVector();
+  print("source reassembled in %f seconds", PCU_Time()-t0);
 }
 
 }
@@ -0,0 +1,70 @@
+/* Cost of compiled expressions against the C++ lambdas they replaced, in
+   nanoseconds per point, for batches of the sizes integration hands to
+   ScalarFunction::evaluate: a single point (boundary tests), one
+   element's points and a block of elements. Run with no arguments. */
+#include "function.h"
+#include <apf.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+double nanosecondsPerPoint(pe::ScalarFunction const& f,
+    std::vector<apf::Vector3> const& points, int n, double& sink)
+{
+  const int total = 1 << 23;
+  std::vector<double> values(n);
+  int offsets = int(points.size()) - n;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int k=0; k < total; k += n)
+  {
+    f.evaluate(n, &points[(k / n * 7) % offsets], &values[0]);
+    sink += values[n-1];
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(t1-t0).count() / total * 1e9;
+}
+
+struct Case
+{
+  const char* source;
+  pe::ScalarFunction::Pointwise lambda;
+};
+
+}
+
+int main()
+{
+  std::vector<apf::Vector3> points(1 << 14);
+  for (std::size_t i=0; i < points.size(); ++i)
+    points[i] = apf::Vector3(drand48(), drand48(), drand48());
+  const double pi = std::acos(-1.0);
+  Case cases[] = {
+    {"-1", [](apf::Vector3 const&) { return -1.; }},
+    {"2*(x*(1-x)+y*(1-y))", [](apf::Vector3 const& p) {
+      return 2.*(p[0]*(1.-p[0])+p[1]*(1.-p[1])); }},
+    {"sin(2*pi*x)*sin(2*pi*y)", [pi](apf::Vector3 const& p) {
+      return std::sin(2*pi*p[0])*std::sin(2*pi*p[1]); }}
+  };
+  const int sizes[] = {1, 11, 704};
+  std::printf("%-26s", "ns per point, lambda/expr");
+  for (int n : sizes)
+    std::printf("  %14s%-4d", "n=", n);
+  std::printf("\n");
+  double sink = 0;
+  for (Case const& c : cases)
+  {
+    pe::ScalarFunction lambda(c.lambda);
+    pe::ScalarFunction expression((pe::Expression(c.source)));
+    std::printf("%-26s", c.source);
+    for (int n : sizes)
+      std::printf("  %8.1f/%-9.1f",
+          nanosecondsPerPoint(lambda, points, n, sink),
+          nanosecondsPerPoint(expression, points, n, sink));
+    std::printf("\n");
+  }
+  return sink == 0.123;
+}
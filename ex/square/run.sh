@@ -1,3 +1,3 @@
 #!/bin/sh
-mpirun -n 4 ../../build/pe_exec square.dmg square.smb out
+mpirun -n 4 ../../build/pe_exec square.dmg square.smb out poisson.ini
 paraview out/out.pvtu
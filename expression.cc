@@ -0,0 +1,567 @@
+#include "expression.h"
+#include "utils.h"
+#include <apf.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace pe {
+
+// points evaluated per pass over the bytecode
+static const int chunk = 64;
+
+// Operands never overlap, which lets these loops be vectorized. A full
+// chunk gets a loop of fixed length, which compilers vectorize at -O2.
+#define PE_APPLY(STATEMENT) \
+  if (n == chunk) \
+    for (int i=0; i < chunk; ++i) \
+      STATEMENT; \
+  else \
+    for (int i=0; i < n; ++i) \
+      STATEMENT;
+
+template <class F>
+static void applyUnary(F f, double* __restrict a, int n)
+{
+  PE_APPLY(a[i] = f(a[i]))
+}
+
+template <class F>
+static void applyBinary(F f, double* __restrict a,
+    double const* __restrict b, int n)
+{
+  PE_APPLY(a[i] = f(a[i], b[i]))
+}
+
+template <class F>
+static void applyImmediate(F f, double* __restrict a, double b, int n)
+{
+  PE_APPLY(a[i] = f(a[i], b))
+}
+
+template <class F>
+static void applyLeft(F f, double b, double* __restrict a, int n)
+{
+  PE_APPLY(a[i] = f(b, a[i]))
+}
+
+#undef PE_APPLY
+
+struct FunctionName
+{
+  const char* name;
+  int op;
+  int nargs;
+};
+
+class ExpressionParser
+{
+  public:
+    // with errors set, the first syntax error is stored there instead of
+    // being fatal and the rest of the source is skipped
+    ExpressionParser(Expression& e, std::string* errors):
+      expr(e),
+      at(e.source.c_str()),
+      errors(errors)
+    {
+    }
+    void parse()
+    {
+      parseOr();
+      skipSpace();
+      if (*at)
+        error("unexpected character");
+    }
+  private:
+    typedef Expression E;
+    void parseOr()
+    {
+      std::size_t left = expr.code.size();
+      parseAnd();
+      while (accept("||"))
+      {
+        std::size_t right = expr.code.size();
+        parseAnd();
+        expr.emitBinary(E::OR, left, right);
+      }
+    }
+    void parseAnd()
+    {
+      std::size_t left = expr.code.size();
+      parseComparison();
+      while (accept("&&"))
+      {
+        std::size_t right = expr.code.size();
+        parseComparison();
+        expr.emitBinary(E::AND, left, right);
+      }
+    }
+    void parseComparison()
+    {
+      std::size_t left = expr.code.size();
+      parseSum();
+      while (true)
+      {
+        E::Opcode op;
+        if (accept("<="))      op = E::LE;
+        else if (accept(">=")) op = E::GE;
+        else if (accept("==")) op = E::EQ;
+        else if (accept("!=")) op = E::NE;
+        else if (accept("<"))  op = E::LT;
+        else if (accept(">"))  op = E::GT;
+        else return;
+        std::size_t right = expr.code.size();
+        parseSum();
+        expr.emitBinary(op, left, right);
+      }
+    }
+    void parseSum()
+    {
+      std::size_t left = expr.code.size();
+      parseProduct();
+      while (true)
+      {
+        E::Opcode op;
+        if (accept("+"))      op = E::ADD;
+        else if (accept("-")) op = E::SUB;
+        else return;
+        std::size_t right = expr.code.size();
+        parseProduct();
+        expr.emitBinary(op, left, right);
+      }
+    }
+    void parseProduct()
+    {
+      std::size_t left = expr.code.size();
+      parseUnary();
+      while (true)
+      {
+        E::Opcode op;
+        if (accept("*"))      op = E::MUL;
+        else if (accept("/")) op = E::DIV;
+        else return;
+        std::size_t right = expr.code.size();
+        parseUnary();
+        expr.emitBinary(op, left, right);
+      }
+    }
+    void parseUnary()
+    {
+      std::size_t start = expr.code.size();
+      if (accept("-"))
+      {
+        parseUnary();
+        emitUnary(E::NEG, start);
+      }
+      else if (accept("!"))
+      {
+        parseUnary();
+        emitUnary(E::NOT, start);
+      }
+      else if (accept("+"))
+        parseUnary();
+      else
+        parsePower();
+    }
+    void parsePower()
+    {
+      std::size_t left = expr.code.size();
+      parsePrimary();
+      if (accept("^"))
+      {
+        std::size_t right = expr.code.size();
+        parseUnary();
+        expr.emitBinary(E::POW, left, right);
+      }
+    }
+    void parsePrimary()
+    {
+      skipSpace();
+      if (accept("("))
+      {
+        parseOr();
+        expect(")");
+        return;
+      }
+      unsigned char c = *at;
+      if (std::isdigit(c) || c == '.')
+      {
+        char* end;
+        double v = std::strtod(at, &end);
+        if (end == at)
+          error("bad number");
+        else
+          at = end;
+        pushConstant(v);
+        return;
+      }
+      if ( ! (std::isalpha(c) || c == '_'))
+      {
+        error("expected a number, name or '('");
+        pushConstant(0);
+        return;
+      }
+      const char* begin = at;
+      while (std::isalnum((unsigned char)*at) || *at == '_')
+        ++at;
+      std::string name(begin, at);
+      if (name == "x")       expr.emit(E::X);
+      else if (name == "y")  expr.emit(E::Y);
+      else if (name == "z")  expr.emit(E::Z);
+      else if (name == "pi") pushConstant(std::acos(-1.0));
+      else if (name == "e")  pushConstant(std::exp(1.0));
+      else
+        parseCall(name);
+    }
+    void parseCall(std::string const& name)
+    {
+      static FunctionName const functions[] = {
+        {"sin", E::SIN, 1}, {"cos", E::COS, 1}, {"tan", E::TAN, 1},
+        {"asin", E::ASIN, 1}, {"acos", E::ACOS, 1}, {"atan", E::ATAN, 1},
+        {"sinh", E::SINH, 1}, {"cosh", E::COSH, 1}, {"tanh", E::TANH, 1},
+        {"exp", E::EXP, 1}, {"log", E::LOG, 1}, {"log10", E::LOG10, 1},
+        {"sqrt", E::SQRT, 1}, {"abs", E::ABS, 1},
+        {"floor", E::FLOOR, 1}, {"ceil", E::CEIL, 1},
+        {"pow", E::POWF, 2}, {"atan2", E::ATAN2, 2},
+        {"min", E::MIN, 2}, {"max", E::MAX, 2},
+        {"if", E::SELECT, 3}
+      };
+      int nfunctions = sizeof(functions) / sizeof(functions[0]);
+      FunctionName const* f = 0;
+      for (int i=0; i < nfunctions; ++i)
+        if (name == functions[i].name)
+          f = &functions[i];
+      if ( ! f)
+      {
+        error("unknown name");
+        pushConstant(0);
+        return;
+      }
+      E::Opcode op = static_cast<E::Opcode>(f->op);
+      std::size_t args[3];
+      expect("(");
+      for (int i=0; i < f->nargs; ++i)
+      {
+        if (i)
+          expect(",");
+        args[i] = expr.code.size();
+        parseOr();
+      }
+      expect(")");
+      if (f->nargs == 1)
+        emitUnary(op, args[0]);
+      else if (f->nargs == 2)
+        expr.emitBinary(op, args[0], args[1]);
+      else
+        expr.emit(op);
+    }
+    void pushConstant(double v)
+    {
+      E::Instruction ins = {E::CONST, E::STACK, v};
+      expr.code.push_back(ins);
+    }
+    // a unary operation on a constant is evaluated right away
+    void emitUnary(E::Opcode op, std::size_t start)
+    {
+      expr.emit(op);
+      if (expr.code.size() - start == 2 && expr.code[start].op == E::CONST)
+      {
+        double v = expr.fold(expr.code.begin() + start, expr.code.end());
+        expr.code.resize(start);
+        pushConstant(v);
+      }
+    }
+    void skipSpace()
+    {
+      while (std::isspace((unsigned char)*at))
+        ++at;
+    }
+    bool accept(const char* token)
+    {
+      skipSpace();
+      std::size_t n = std::strlen(token);
+      if (std::strncmp(at, token, n))
+        return false;
+      at += n;
+      return true;
+    }
+    void expect(const char* token)
+    {
+      if ( ! accept(token))
+        error("missing token");
+    }
+    void error(const char* what)
+    {
+      const char* source = expr.source.c_str();
+      if ( ! errors)
+        fail("expression \"%s\": %s at position %d",
+            source, what, int(at - source));
+      if (errors->empty())
+      {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), " at position %d", int(at - source));
+        *errors = std::string("expression \"") + source + "\": " + what + buf;
+      }
+      at = source + expr.source.size();
+    }
+    Expression& expr;
+    const char* at;
+    std::string* errors;
+};
+
+Expression::Expression():
+  source("0"),
+  depth(1),
+  usesPosition(false)
+{
+  Instruction ins = {CONST, STACK, 0.0};
+  code.push_back(ins);
+  stack.resize((depth + 3) * chunk);
+}
+
+Expression::Expression(std::string const& s):
+  source(s),
+  depth(0),
+  usesPosition(false)
+{
+  compile(0);
+}
+
+// On a syntax error errors is set and the expression is left as 0
+Expression::Expression(std::string const& s, std::string& errors):
+  source(s),
+  depth(0),
+  usesPosition(false)
+{
+  errors.clear();
+  compile(&errors);
+}
+
+void Expression::compile(std::string* errors)
+{
+  ExpressionParser parser(*this, errors);
+  parser.parse();
+  if (errors && ! errors->empty())
+  {
+    Instruction ins = {CONST, STACK, 0.0};
+    code.assign(1, ins);
+  }
+  int sp = 0;
+  for (std::size_t i=0; i < code.size(); ++i)
+  {
+    Opcode op = code[i].op;
+    if (op == CONST || op == X || op == Y || op == Z)
+      ++sp;
+    else if (op == SELECT)
+      sp -= 2;
+    else if (op >= ADD && code[i].operand == STACK)
+      --sp;
+    depth = std::max(depth, sp);
+    if ((op >= X && op <= Z) || code[i].operand >= RIGHT_X)
+      usesPosition = true;
+  }
+  ASSERT(sp == 1);
+  stack.resize((depth + 3) * chunk);
+}
+
+void Expression::emit(Opcode op)
+{
+  Instruction ins = {op, STACK, 0.0};
+  code.push_back(ins);
+}
+
+// how a lone constant or coordinate instruction can be folded into the
+// binary instruction using it, as its right operand
+Expression::Operand Expression::getOperand(Instruction const& ins)
+{
+  switch (ins.op)
+  {
+    case CONST: return RIGHT_VALUE;
+    case X: return RIGHT_X;
+    case Y: return RIGHT_Y;
+    case Z: return RIGHT_Z;
+    default: return STACK;
+  }
+}
+
+// Binary operations on constants are evaluated right away. Otherwise a
+// constant operand, or failing that a coordinate one, is folded into the
+// instruction; a left one only if the operation commutes, except for
+// constants, which can be applied from the left.
+void Expression::emitBinary(Opcode op, std::size_t left, std::size_t right)
+{
+  Operand l = (right - left == 1) ? getOperand(code[left]) : STACK;
+  Operand r = (code.size() - right == 1) ? getOperand(code[right]) : STACK;
+  bool commutes = op == ADD || op == MUL || op == EQ || op == NE ||
+                  op == AND || op == OR || op == MIN || op == MAX;
+  if (l == RIGHT_VALUE && r == RIGHT_VALUE)
+  {
+    emit(op);
+    double v = fold(code.begin() + left, code.end());
+    code.resize(left);
+    Instruction ins = {CONST, STACK, v};
+    code.push_back(ins);
+    return;
+  }
+  if (r == RIGHT_VALUE || (r != STACK && l != RIGHT_VALUE))
+  {
+    Instruction ins = {op, r, code.back().value};
+    code.pop_back();
+    code.push_back(ins);
+    return;
+  }
+  if (l == RIGHT_VALUE || (l != STACK && commutes))
+  {
+    Operand o = (l == RIGHT_VALUE && ! commutes) ? LEFT_VALUE : l;
+    Instruction ins = {op, o, code[left].value};
+    code.erase(code.begin() + left);
+    code.push_back(ins);
+    return;
+  }
+  emit(op);
+}
+
+// evaluate a short constant instruction sequence
+double Expression::fold(
+    std::vector<Instruction>::iterator begin,
+    std::vector<Instruction>::iterator end)
+{
+  Expression c;
+  c.code.assign(begin, end);
+  c.depth = 2;
+  c.stack.resize((c.depth + 3) * chunk);
+  return c(apf::Vector3(0,0,0));
+}
+
+double Expression::operator()(apf::Vector3 const& x) const
+{
+  double v;
+  evaluate(1, &x, &v);
+  return v;
+}
+
+std::string const& Expression::getSource() const
+{
+  return source;
+}
+
+bool Expression::isConstant() const
+{
+  return code.size() == 1 && code[0].op == CONST;
+}
+
+void Expression::evaluate(int n, apf::Vector3 const* x, double* values) const
+{
+  for (int start=0; start < n; start += chunk)
+  {
+    int m = std::min(chunk, n - start);
+    apf::Vector3 const* p = x + start;
+    double* position = &stack[depth * chunk];
+    if (usesPosition)
+      for (int i=0; i < m; ++i)
+        for (int j=0; j < 3; ++j)
+          position[j * chunk + i] = p[i][j];
+    int sp = -1;
+    for (std::size_t k=0; k < code.size(); ++k)
+    {
+      Instruction const& ins = code[k];
+      double* a = &stack[0];
+      switch (ins.op)
+      {
+        case CONST: case X: case Y: case Z:
+          a = &stack[++sp * chunk];
+          break;
+        case SELECT:
+          sp -= 2;
+          a = &stack[sp * chunk];
+          break;
+        default:
+          if (ins.op >= ADD && ins.operand == STACK)
+            --sp;
+          a = &stack[sp * chunk];
+      }
+      double const* b = a + chunk;
+      double v = ins.value;
+      switch (ins.op)
+      {
+        case CONST:
+          std::fill(a, a + m, v);
+          break;
+        case X: case Y: case Z:
+          std::copy(position + (ins.op - X) * chunk,
+              position + (ins.op - X) * chunk + m, a);
+          break;
+        case NEG:
+          applyUnary([](double s) { return -s; }, a, m);
+          break;
+        case NOT:
+          applyUnary([](double s) { return double(s == 0); }, a, m);
+          break;
+#define PE_UNARY(OP, F) \
+        case OP: \
+          applyUnary([](double s) { return F(s); }, a, m); \
+          break;
+        PE_UNARY(SIN, std::sin)
+        PE_UNARY(COS, std::cos)
+        PE_UNARY(TAN, std::tan)
+        PE_UNARY(ASIN, std::asin)
+        PE_UNARY(ACOS, std::acos)
+        PE_UNARY(ATAN, std::atan)
+        PE_UNARY(SINH, std::sinh)
+        PE_UNARY(COSH, std::cosh)
+        PE_UNARY(TANH, std::tanh)
+        PE_UNARY(EXP, std::exp)
+        PE_UNARY(LOG, std::log)
+        PE_UNARY(LOG10, std::log10)
+        PE_UNARY(SQRT, std::sqrt)
+        PE_UNARY(ABS, std::fabs)
+        PE_UNARY(FLOOR, std::floor)
+        PE_UNARY(CEIL, std::ceil)
+#undef PE_UNARY
+#define PE_BINARY(OP, EXPR) \
+        case OP: \
+        { \
+          auto f = [](double s, double t) { return EXPR; }; \
+          if (ins.operand == STACK) \
+            applyBinary(f, a, b, m); \
+          else if (ins.operand == RIGHT_VALUE) \
+            applyImmediate(f, a, v, m); \
+          else if (ins.operand == LEFT_VALUE) \
+            applyLeft(f, v, a, m); \
+          else \
+            applyBinary(f, a, \
+                position + (ins.operand - RIGHT_X) * chunk, m); \
+          break; \
+        }
+        PE_BINARY(ADD, s + t)
+        PE_BINARY(SUB, s - t)
+        PE_BINARY(MUL, s * t)
+        PE_BINARY(DIV, s / t)
+        PE_BINARY(POW, std::pow(s, t))
+        PE_BINARY(POWF, std::pow(s, t))
+        PE_BINARY(LT, double(s < t))
+        PE_BINARY(LE, double(s <= t))
+        PE_BINARY(GT, double(s > t))
+        PE_BINARY(GE, double(s >= t))
+        PE_BINARY(EQ, double(s == t))
+        PE_BINARY(NE, double(s != t))
+        PE_BINARY(AND, double(s != 0 && t != 0))
+        PE_BINARY(OR, double(s != 0 || t != 0))
+        PE_BINARY(ATAN2, std::atan2(s, t))
+        PE_BINARY(MIN, std::min(s, t))
+        PE_BINARY(MAX, std::max(s, t))
+#undef PE_BINARY
+        case SELECT:
+          for (int i=0; i < m; ++i)
+            a[i] = a[i] != 0 ? b[i] : b[i + chunk];
+          break;
+      }
+    }
+    std::copy(&stack[0], &stack[0] + m, values + start);
+  }
+}
+
+}
@@ -0,0 +1,77 @@
+#ifndef PE_EXPRESSION_H
+#define PE_EXPRESSION_H
+
+#include <string>
+#include <vector>
+
+namespace apf {
+class Vector3;
+}
+
+namespace pe {
+
+/* A scalar function of position compiled from text such as
+   "sin(2*pi*x)*sin(2*pi*y)" into a small stack bytecode.
+
+   Operators, loosest first: || && == != < <= > >= + - * / unary -,!
+   and ^ (right associative). Comparisons and logic give 0 or 1.
+   Names: x y z pi e. Functions: sin cos tan asin acos atan sinh cosh
+   tanh exp log log10 sqrt abs floor ceil, pow atan2 min max, and
+   if(c,a,b) which evaluates both branches.
+
+   evaluate() runs each instruction over a whole batch of points, so
+   the interpretation overhead is paid once per batch, not per point. */
+class Expression
+{
+  public:
+    Expression();
+    explicit Expression(std::string const& source);
+    Expression(std::string const& source, std::string& errors);
+    double operator()(apf::Vector3 const& x) const;
+    void evaluate(int n, apf::Vector3 const* x, double* values) const;
+    std::string const& getSource() const;
+    bool isConstant() const;
+  private:
+    enum Opcode
+    {
+      CONST, X, Y, Z,
+      NEG, NOT,
+      SIN, COS, TAN, ASIN, ACOS, ATAN, SINH, COSH, TANH,
+      EXP, LOG, LOG10, SQRT, ABS, FLOOR, CEIL,
+      ADD, SUB, MUL, DIV, POW,
+      LT, LE, GT, GE, EQ, NE, AND, OR,
+      POWF, ATAN2, MIN, MAX,
+      SELECT
+    };
+    /* where a binary operator finds the operand that is not on top of
+       the stack: below it, in value (as its right or left operand), or
+       in a coordinate */
+    enum Operand
+    {
+      STACK, RIGHT_VALUE, LEFT_VALUE, RIGHT_X, RIGHT_Y, RIGHT_Z
+    };
+    struct Instruction
+    {
+      Opcode op;
+      Operand operand;
+      double value;
+    };
+    friend class ExpressionParser;
+    void compile(std::string* errors);
+    void emit(Opcode op);
+    void emitBinary(Opcode op, std::size_t left, std::size_t right);
+    static Operand getOperand(Instruction const& ins);
+    static double fold(
+        std::vector<Instruction>::iterator begin,
+        std::vector<Instruction>::iterator end);
+    std::string source;
+    std::vector<Instruction> code;
+    int depth;
+    bool usesPosition;
+    // depth chunks of stack, then x, y and z of the points in a chunk
+    mutable std::vector<double> stack;
+};
+
+}
+
+#endif
@@ -0,0 +1,31 @@
+#include "function.h"
+#include <apf.h>
+
+namespace pe {
+
+ScalarFunction::ScalarFunction(Pointwise f):
+  pointwise(f)
+{
+}
+
+ScalarFunction::ScalarFunction(Expression const& e):
+  expression(e)
+{
+}
+
+double ScalarFunction::operator()(apf::Vector3 const& x) const
+{
+  if (pointwise)
+    return pointwise(x);
+  return expression(x);
+}
+
+void ScalarFunction::evaluate(int n, apf::Vector3 const* x, double* values) const
+{
+  if ( ! pointwise)
+    return expression.evaluate(n, x, values);
+  for (int i=0; i < n; ++i)
+    values[i] = pointwise(x[i]);
+}
+
+}
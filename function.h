@@ -0,0 +1,27 @@
+#ifndef PE_FUNCTION_H
+#define PE_FUNCTION_H
+
+#include "expression.h"
+#include <functional>
+
+namespace pe {
+
+/* Problem data as a function of position: either a compiled Expression
+   or any C++ callable. Batches of points are handed to the expression
+   in one call and looped over for a callable. */
+class ScalarFunction
+{
+  public:
+    typedef std::function<double(apf::Vector3 const&)> Pointwise;
+    ScalarFunction(Pointwise f);
+    ScalarFunction(Expression const& e);
+    double operator()(apf::Vector3 const& x) const;
+    void evaluate(int n, apf::Vector3 const* x, double* values) const;
+  private:
+    Pointwise pointwise;
+    Expression expression;
+};
+
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include "ghost.h"
+#include "utils.h"
+#include <apfMesh2.h>
+#include <apfNumbering.h>
+#include <apfShape.h>
+#include <pumi.h>
+#include <PCU.h>
+
+namespace pe {
+
+static int getTagBytes(apf::Mesh* m, apf::MeshTag* t)
+{
+  int type = m->getTagType(t);
+  int size = type == apf::Mesh::DOUBLE ? sizeof(double) :
+             type == apf::Mesh::LONG ? sizeof(long) : sizeof(int);
+  return m->getTagSize(t) * size;
+}
+
+// What migrating a ghost entity packs: its type, model entity, owner
+// part and owner's entity, then its coordinates if it is a vertex or its
+// boundary entities otherwise, then every tag it carries
+static double getGhostBytes(apf::Mesh* m, apf::MeshEntity* e, int d,
+    apf::DynamicArray<apf::MeshTag*>& tags)
+{
+  double bytes = 4 * sizeof(int) + sizeof(apf::MeshEntity*);
+  if (d == 0)
+    bytes += 6 * sizeof(double);
+  else
+  {
+    apf::Downward down;
+    bytes += m->getDownward(e, d - 1, down) * sizeof(apf::MeshEntity*);
+  }
+  for (std::size_t i=0; i < tags.getSize(); ++i)
+    if (m->hasTag(e, tags[i]))
+      bytes += getTagBytes(m, tags[i]);
+  return bytes;
+}
+
+// One layer of elements bridged by vertices: every element that touches
+// a node owned by this part is then present on it. PUMI does not report
+// its traffic, so it is estimated from the ghosts that arrived here: the
+// returned bytes were received rather than sent by this part.
+double createGhostLayer(apf::Mesh2* m)
+{
+  double t0 = PCU_Time();
+  int dim = m->getDimension();
+  pumi_ghost_createLayer(m, 0, dim, 1, 0);
+  apf::DynamicArray<apf::MeshTag*> tags;
+  m->getTags(tags);
+  long n = 0;
+  double bytes = 0;
+  for (int d=0; d <= dim; ++d)
+  {
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(d);
+    while ((e = m->iterate(it)))
+    {
+      if ( ! m->isGhost(e))
+        continue;
+      bytes += getGhostBytes(m, e, d, tags);
+      if (d == dim)
+        ++n;
+    }
+    m->end(it);
+  }
+  PCU_Add_Longs(&n, 1);
+  double t1 = PCU_Time();
+  print("ghosted %ld elements in %f seconds", n, t1-t0);
+  return bytes;
+}
+
+// Ghost entities are created after the numbering, so their numbers are
+// sent over from the entities they copy. Returns the bytes this part sent.
+double synchronizeGhostNumbers(
+    apf::Mesh2* m,
+    apf::FieldShape* s,
+    apf::GlobalNumbering* n)
+{
+  double bytes = 0;
+  PCU_Comm_Begin();
+  for (int d=0; d <= m->getDimension(); ++d)
+  {
+    if ( ! s->hasNodesIn(d))
+      continue;
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(d);
+    while ((e = m->iterate(it)))
+    {
+      if ( ! m->isGhosted(e))
+        continue;
+      int nn = s->countNodesOn(m->getType(e));
+      apf::Copies ghosts;
+      m->getGhosts(e, ghosts);
+      APF_ITERATE(apf::Copies, ghosts, git)
+      {
+        PCU_COMM_PACK(git->first, git->second);
+        for (int j=0; j < nn; ++j)
+        {
+          long number = apf::getNumber(n, apf::Node(e, j));
+          PCU_COMM_PACK(git->first, number);
+        }
+        bytes += sizeof(apf::MeshEntity*) + nn * sizeof(long);
+      }
+    }
+    m->end(it);
+  }
+  PCU_Comm_Send();
+  while (PCU_Comm_Receive())
+  {
+    apf::MeshEntity* e;
+    PCU_COMM_UNPACK(e);
+    int nn = s->countNodesOn(m->getType(e));
+    for (int j=0; j < nn; ++j)
+    {
+      long number;
+      PCU_COMM_UNPACK(number);
+      apf::number(n, apf::Node(e, j), number);
+    }
+  }
+  return bytes;
+}
+
+void destroyGhostLayer(apf::Mesh2* m)
+{
+  pumi_ghost_delete(m);
+}
+
+}
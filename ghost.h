@@ -0,0 +1,22 @@
+#ifndef PE_GHOST_H
+#define PE_GHOST_H
+
+namespace apf {
+class Mesh2;
+class FieldShape;
+template <class T> class NumberingOf;
+typedef NumberingOf<long> GlobalNumbering;
+}
+
+namespace pe {
+
+double createGhostLayer(apf::Mesh2* m);
+double synchronizeGhostNumbers(
+    apf::Mesh2* m,
+    apf::FieldShape* s,
+    apf::GlobalNumbering* n);
+void destroyGhostLayer(apf::Mesh2* m);
+
+}
+
+#endif
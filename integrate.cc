@@ -4,20 +4,72 @@
 
 namespace pe {
 
-Integrate::Integrate(int integr_ord, apf::Field* f, std::function<double(apf::Vector3 const&)> rhs_fun) :
+IntPointValues::IntPointValues(int order, ScalarFunction const& f):
+  order(order),
+  function(f),
+  next(0)
+{
+}
+
+void IntPointValues::evaluate(apf::MeshElement* const* elements, int n)
+{
+  block.assign(elements, elements + n);
+  offsets.resize(n + 1);
+  points.clear();
+  for (int k=0; k < n; ++k)
+  {
+    offsets[k] = points.size();
+    int np = apf::countIntPoints(elements[k], order);
+    for (int i=0; i < np; ++i)
+    {
+      apf::Vector3 p, x;
+      apf::getIntPoint(elements[k], order, i, p);
+      apf::mapLocalToGlobal(elements[k], p, x);
+      points.push_back(x);
+    }
+  }
+  offsets[n] = points.size();
+  values.resize(points.size());
+  if ( ! points.empty())
+    function.evaluate(points.size(), &points[0], &values[0]);
+  next = 0;
+}
+
+// Elements are expected in block order, atPoint then just walks through
+// the values of their points
+double const* IntPointValues::get(apf::MeshElement* me)
+{
+  if (next == block.size() || block[next] != me)
+    evaluate(&me, 1);
+  double const* v = values.data() + offsets[next];
+  ++next;
+  return v;
+}
+
+Integrate::Integrate(int integr_ord, apf::Field* f, ScalarFunction const& rhs_fun) :
     apf::Integrator(integr_ord),
+    flops(0),
     u(f),
-    rhs(rhs_fun),
+    rhs(integr_ord, rhs_fun),
     ndims(apf::getMesh(f)->getDimension())
 {
 }
 
+void Integrate::prepare(apf::MeshElement* const* elements, int n)
+{
+  rhs.evaluate(elements, n);
+}
+
 void Integrate::inElement(apf::MeshElement* me)
 {
   e = apf::createElement(u,me);
   ndofs = apf::countNodes(e);
   fe.setSize(ndofs);
   ke.setSize(ndofs,ndofs);
+  values = rhs.get(me);
+  point = 0;
+  // the arithmetic of atPoint, 4 flops per fe term and 10 per ke term
+  flops += apf::countIntPoints(me, order) * ndofs * (4.0 + 10.0 * ndims * ndofs);
   for (int a=0; a < ndofs; ++a)
   {
     fe(a) = 0.0;
@@ -39,13 +91,11 @@ void Integrate::atPoint(apf::Vector3 const& p, double w, double dv)
   apf::NewArray<apf::Vector3> gradBF;
   apf::getShapeGrads(e,p,gradBF);
 
-  apf::Vector3 x;
-  apf::MeshElement* me = apf::getMeshElement(e);
-  apf::mapLocalToGlobal(me,p,x);
+  double f = values[point++];
 
   for (int a=0; a < ndofs; ++a)
   {
-    fe(a) += rhs(x) * BF[a] * w * dv;
+    fe(a) += f * BF[a] * w * dv;
     for (int b=0; b < ndofs; ++b)
     for (int i=0; i < ndims; ++i)
       ke(a,b) += 0.1 * gradBF[a][i] * gradBF[b][i] * w * dv +
@@ -53,15 +103,59 @@ void Integrate::atPoint(apf::Vector3 const& p, double w, double dv)
   }
 }
 
+IntegrateSource::IntegrateSource(int integr_ord, apf::Field* f, ScalarFunction const& rhs_fun) :
+    apf::Integrator(integr_ord),
+    u(f),
+    rhs(integr_ord, rhs_fun)
+{
+}
+
+void IntegrateSource::prepare(apf::MeshElement* const* elements, int n)
+{
+  rhs.evaluate(elements, n);
+}
+
+void IntegrateSource::inElement(apf::MeshElement* me)
+{
+  e = apf::createElement(u,me);
+  ndofs = apf::countNodes(e);
+  fe.setSize(ndofs);
+  for (int a=0; a < ndofs; ++a)
+    fe(a) = 0.0;
+  values = rhs.get(me);
+  point = 0;
+}
+
+void IntegrateSource::outElement()
+{
+  apf::destroyElement(e);
+}
+
+// the same source term as Integrate::atPoint
+void IntegrateSource::atPoint(apf::Vector3 const& p, double w, double dv)
+{
+  apf::NewArray<double> BF;
+  apf::getShapeValues(e,p,BF);
+  double f = values[point++];
+  for (int a=0; a < ndofs; ++a)
+    fe(a) += f * BF[a] * w * dv;
+}
+
 //-------------------------
-IntegrateNeuBC::IntegrateNeuBC(int integr_ord, apf::Field* f, std::function<double(apf::Vector3 const&)> g_neu) : 
+IntegrateNeuBC::IntegrateNeuBC(int integr_ord, apf::Field* f, ScalarFunction const& g_neu) : 
     apf::Integrator(integr_ord),
+    flops(0),
     f(f),
-    g_neu(g_neu),
+    g_neu(integr_ord, g_neu),
     n_dims(apf::getMesh(f)->getDimension()-1)
 {
 }
 
+void IntegrateNeuBC::prepare(apf::MeshElement* const* elements, int n)
+{
+  g_neu.evaluate(elements, n);
+}
+
 void IntegrateNeuBC::inElement(apf::MeshElement* me)
 {
   e = apf::createElement(f,me);
@@ -69,6 +163,10 @@ void IntegrateNeuBC::inElement(apf::MeshElement* me)
   fe.setSize(n_dofs);
   for (auto&& fe_i : fe)
     fe_i = 0.0;
+  values = g_neu.get(me);
+  point = 0;
+  // the arithmetic of atPoint, 4 flops per fe term
+  flops += apf::countIntPoints(me, order) * n_dofs * 4.0;
 }
 
 void IntegrateNeuBC::outElement()
@@ -81,11 +179,9 @@ void IntegrateNeuBC::atPoint(apf::Vector3 const& p, double w, double dv)
   apf::NewArray<double> BF;
   apf::getShapeValues(e,p,BF);
   
-  apf::Vector3 x;
-  apf::MeshElement* me = apf::getMeshElement(e);
-  apf::mapLocalToGlobal(me,p,x);
-  
+  double g = values[point++];
+
   for (int a=0; a<n_dofs; ++a)
-    fe(a) += g_neu(x) * BF[a] * w * dv;
+    fe(a) += g * BF[a] * w * dv;
 }
 }
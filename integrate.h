@@ -4,46 +4,119 @@
 #include <apf.h>
 #include <apfDynamicVector.h>
 #include <apfDynamicMatrix.h>
-#include <functional>
+#include "function.h"
+#include <algorithm>
+#include <vector>
 
 namespace pe {
 
+/* A data function at the integration points of elements. A block of
+   elements can be evaluated in one call beforehand, so that an
+   Expression runs over hundreds of points at a time rather than over
+   one element's few; elements outside the block are evaluated alone. */
+class IntPointValues
+{
+  public:
+    IntPointValues(int order, ScalarFunction const& f);
+    void evaluate(apf::MeshElement* const* elements, int n);
+    double const* get(apf::MeshElement* me);
+  private:
+    int order;
+    ScalarFunction function;
+    std::vector<apf::MeshElement*> block;
+    std::vector<int> offsets;
+    std::size_t next;
+    std::vector<apf::Vector3> points;
+    std::vector<double> values;
+};
+
 class Integrate : public apf::Integrator
 {
   public:
-    Integrate(int integr_ord, apf::Field* f, std::function<double(apf::Vector3 const&)> rhs_fun);
+    Integrate(int integr_ord, apf::Field* f, ScalarFunction const& rhs_fun);
     void inElement(apf::MeshElement*) override;
     void outElement() override;
     void atPoint(apf::Vector3 const& p, double w, double dv) override;
+    void prepare(apf::MeshElement* const* elements, int n);
     apf::DynamicVector fe;
     apf::DynamicMatrix ke;
+    double flops;
   private:
     int ndofs;
     int ndims;
     apf::Field* u;
     apf::Element* e;
-    std::function<double(apf::Vector3 const&)> rhs;
+    IntPointValues rhs;
+    double const* values;
+    int point;
+};
+
+// The load vector of the source term alone, for a new source on an
+// already assembled matrix
+class IntegrateSource : public apf::Integrator
+{
+  public:
+    IntegrateSource(int integr_ord, apf::Field* f, ScalarFunction const& rhs_fun);
+    void inElement(apf::MeshElement*) override;
+    void outElement() override;
+    void atPoint(apf::Vector3 const& p, double w, double dv) override;
+    void prepare(apf::MeshElement* const* elements, int n);
+    apf::DynamicVector fe;
+  private:
+    int ndofs;
+    apf::Field* u;
+    apf::Element* e;
+    IntPointValues rhs;
+    double const* values;
+    int point;
 };
 
 //----------------------
 class IntegrateNeuBC : public apf::Integrator
 {
 public:
-    IntegrateNeuBC(int integr_ord, apf::Field* f, std::function<double(apf::Vector3 const&)> g_neu);
+    IntegrateNeuBC(int integr_ord, apf::Field* f, ScalarFunction const& g_neu);
     void inElement(apf::MeshElement*) override;
     void outElement() override;
     void atPoint(apf::Vector3 const& p, double w, double dv) override;
+    void prepare(apf::MeshElement* const* elements, int n);
     apf::DynamicVector fe;
+    double flops;
 private:
     int n_dofs;
     int n_dims;
     apf::Field* f;
     apf::Element* e;
-    std::function<double(apf::Vector3 const&)> g_neu;
+    IntPointValues g_neu;
+    double const* values;
+    int point;
 
 };
 
 
+/* Integrates elements[0..n) in blocks whose data functions are evaluated
+   together, calling use(i) once element i has been processed */
+template <class I, class F>
+void integrateInBlocks(I& integrator, apf::Mesh* m,
+    apf::MeshEntity* const* elements, std::size_t n, F use)
+{
+  const std::size_t block = 64;
+  apf::MeshElement* mes[block];
+  for (std::size_t b=0; b < n; b += block)
+  {
+    std::size_t nb = std::min(block, n - b);
+    for (std::size_t i=0; i < nb; ++i)
+      mes[i] = apf::createMeshElement(m, elements[b + i]);
+    integrator.prepare(mes, nb);
+    for (std::size_t i=0; i < nb; ++i)
+    {
+      integrator.process(mes[i]);
+      use(b + i);
+      apf::destroyMeshElement(mes[i]);
+    }
+  }
+}
+
 }
 
 #endif
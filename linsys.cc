@@ -1,11 +1,22 @@
 #include "linsys.h"
 #include "utils.h"
+#include "memory.h"
+#include "schwarz.h"
+#include "perf.h"
 #include <apfDynamicVector.h>
 #include <PCU.h>
+#include <algorithm>
 
 namespace pe {
 
-LinSys::LinSys(int n, long N)
+LinSys::LinSys(int n, long N) :
+  A0(PETSC_NULL),
+  b0(PETSC_NULL),
+  scratchA(PETSC_NULL),
+  scratchB(PETSC_NULL),
+  preconditioned(false),
+  reusing(false),
+  schwarz(0)
 {
   print("%lu total unknowns", N);
   CALL( VecCreateMPI(PETSC_COMM_WORLD, n, N, &b) );
@@ -16,6 +27,10 @@ LinSys::LinSys(int n, long N)
   CALL( KSPCreate(PETSC_COMM_WORLD, &solver) );
   CALL( KSPSetTolerances(solver, 1.0e-8, 1.0e-8, PETSC_DEFAULT, 100) );
   CALL( VecDuplicate(b, &x) );
+  MatInfo info;
+  CALL( MatGetInfo(A, MAT_LOCAL, &info) );
+  recordMemory("matrix", info.memory);
+  recordMemory("vectors", 2.0 * n * sizeof(PetscScalar));
 }
 
 LinSys::~LinSys()
@@ -24,6 +39,11 @@ LinSys::~LinSys()
   CALL( VecDestroy(&x) );
   CALL( VecDestroy(&b) );
   CALL( KSPDestroy(&solver) );
+  delete schwarz;
+  if (A0)
+    CALL( MatDestroy(&A0) );
+  if (b0)
+    CALL( VecDestroy(&b0) );
 }
 
 void LinSys::setToVector(int sz, long* rows, double* vals)
@@ -44,6 +64,13 @@ void LinSys::addToMatrix(int sz, long* rows, double* vals)
   CALL( MatSetValues(A, sz, r, sz, r, vals, ADD_VALUES) );
 }
 
+void LinSys::addToMatrix(int nr, long* rows, int nc, long* cols, double* vals)
+{
+  PetscInt* r = (PetscInt*)rows;
+  PetscInt* c = (PetscInt*)cols;
+  CALL( MatSetValues(A, nr, r, nc, c, vals, ADD_VALUES) );
+}
+
 void LinSys::zeroToVector(int sz, long* rows)
 {
   PetscInt* r = (PetscInt*)rows;
@@ -59,6 +86,21 @@ void LinSys::diagMatRow(int sz, long* rows)
   CALL( MatZeroRows(A, sz, r, 1.0, PETSC_NULL, PETSC_NULL) );
 }
 
+// Start sending the off-process entries stashed so far. Nothing may be
+// inserted until endSynchronize, and synchronize must still be called
+// once all entries have been inserted.
+void LinSys::beginSynchronize()
+{
+  CALL( VecAssemblyBegin(b) );
+  CALL( MatAssemblyBegin(A, MAT_FLUSH_ASSEMBLY) );
+}
+
+void LinSys::endSynchronize()
+{
+  CALL( VecAssemblyEnd(b) );
+  CALL( MatAssemblyEnd(A, MAT_FLUSH_ASSEMBLY) );
+}
+
 void LinSys::synchronize()
 {
   CALL( VecAssemblyBegin(b) );
@@ -67,6 +109,80 @@ void LinSys::synchronize()
   CALL( MatAssemblyEnd(A, MAT_FINAL_ASSEMBLY) );
 }
 
+void LinSys::getOwnedRange(long& first, long& last)
+{
+  PetscInt f, l;
+  CALL( VecGetOwnershipRange(b, &f, &l) );
+  first = f;
+  last = l;
+}
+
+// bytes of off-process entries waiting for the next synchronize
+double LinSys::getStashBytes()
+{
+  PetscInt vn, vr, vbn, vbr;
+  CALL( VecStashGetInfo(b, &vn, &vr, &vbn, &vbr) );
+  PetscInt mn, mr, mbn, mbr;
+  CALL( MatStashGetInfo(A, &mn, &mr, &mbn, &mbr) );
+  return double(vn) * (sizeof(PetscInt) + sizeof(PetscScalar)) +
+         double(mn) * (2 * sizeof(PetscInt) + sizeof(PetscScalar));
+}
+
+// promise that no more off-process matrix entries will be inserted, which
+// lets the matrix assembly skip its communication
+void LinSys::disableOffProcEntries()
+{
+  CALL( MatSetOption(A, MAT_NO_OFF_PROC_ENTRIES, PETSC_TRUE) );
+}
+
+// Copy the assembled, unconstrained system. Zeroing rows then keeps the
+// nonzero pattern so the copy can be restored cheaply.
+void LinSys::saveVolumeSystem()
+{
+  double m0 = getMemoryUsage();
+  CALL( MatSetOption(A, MAT_KEEP_NONZERO_PATTERN, PETSC_TRUE) );
+  CALL( MatDuplicate(A, MAT_COPY_VALUES, &A0) );
+  CALL( VecDuplicate(b, &b0) );
+  CALL( VecCopy(b, b0) );
+  recordMemory("volume system copy (RSS estimate)", getMemoryUsage()-m0);
+}
+
+void LinSys::zeroVector()
+{
+  CALL( VecSet(b, 0.0) );
+}
+
+// replace the saved load vector with b, the saved matrix is kept
+void LinSys::saveVolumeVector()
+{
+  ASSERT(b0);
+  CALL( VecCopy(b, b0) );
+}
+
+void LinSys::restoreVolumeSystem(bool matrix)
+{
+  ASSERT(A0 && b0);
+  if (matrix)
+    CALL( MatCopy(A0, A, SAME_NONZERO_PATTERN) );
+  CALL( VecCopy(b0, b) );
+}
+
+void LinSys::reusePreconditioner(bool reuse)
+{
+  CALL( KSPSetReusePreconditioner(solver, reuse ? PETSC_TRUE : PETSC_FALSE) );
+  reusing = reuse;
+}
+
+// subdomain holds the rows of this part's overlapping subdomain. The
+// preconditioner can still be overridden with -pc_type.
+void LinSys::useTwoLevelSchwarz(std::vector<long>& subdomain)
+{
+  long first, last;
+  getOwnedRange(first, last);
+  schwarz = new TwoLevelSchwarz(subdomain, first, last);
+  schwarz->attach(solver);
+}
+
 void LinSys::getSolution(apf::DynamicVector& sol)
 {
   PetscInt n;
@@ -79,14 +195,78 @@ void LinSys::getSolution(apf::DynamicVector& sol)
   CALL( VecRestoreArray(x, &X) );
 }
 
+// the matrix is preallocated for 600 nonzeros per row, report how much
+// of that the assembled operator actually uses
+void LinSys::printMatrixUsage()
+{
+  MatInfo info;
+  CALL( MatGetInfo(A, MAT_GLOBAL_SUM, &info) );
+  print("matrix nonzeros: %.0f used, %.0f allocated",
+      info.nz_used, info.nz_allocated);
+}
+
+// Until endScratch, insertions go to zeroed copies of the matrix and
+// vector with the same layout, leaving the system itself untouched
+void LinSys::beginScratch()
+{
+  ASSERT( ! scratchA);
+  CALL( MatDuplicate(A, MAT_DO_NOT_COPY_VALUES, &scratchA) );
+  CALL( VecDuplicate(b, &scratchB) );
+  std::swap(A, scratchA);
+  std::swap(b, scratchB);
+}
+
+void LinSys::endScratch()
+{
+  synchronize();
+  std::swap(A, scratchA);
+  std::swap(b, scratchB);
+  CALL( MatDestroy(&scratchA) );
+  CALL( VecDestroy(&scratchB) );
+  scratchA = PETSC_NULL;
+  scratchB = PETSC_NULL;
+}
+
+// Time n products with the assembled operator for the roofline report,
+// PETSc counts their flops. x is only read.
+void LinSys::measureMatMult(int n)
+{
+  Vec y;
+  CALL( VecDuplicate(x, &y) );
+  CALL( MatMult(A, x, y) );
+  PerfSample s0 = readCounters();
+  for (int i=0; i < n; ++i)
+    CALL( MatMult(A, x, y) );
+  recordPerf(PERF_SPMV, s0);
+  CALL( VecDestroy(&y) );
+}
+
+// the preconditioner is charged with whatever KSPSetUp allocates
 void LinSys::solve()
 {
   double t0 = PCU_Time();
   CALL( KSPSetOperators(solver, A, A) );
   CALL( KSPSetFromOptions(solver) );
+  // only a setup that builds the preconditioner adds to its memory, a
+  // rebuild frees the old one first so it only charges any growth
+  bool building = ! (preconditioned && reusing);
+  double m0 = getMemoryUsage();
+  CALL( KSPSetUp(solver) );
+  if (building)
+    recordMemory("preconditioner (RSS estimate)", getMemoryUsage()-m0);
+  preconditioned = true;
   CALL( KSPSolve(solver, b, x) );
   double t1 = PCU_Time();
-  print("linear system solved in %f seconds", t1-t0);
+  PetscInt its;
+  CALL( KSPGetIterationNumber(solver, &its) );
+  print("linear system solved in %f seconds, %ld iterations", t1-t0, (long)its);
+}
+
+int LinSys::getIterations()
+{
+  PetscInt its;
+  CALL( KSPGetIterationNumber(solver, &its) );
+  return int(its);
 }
 
 }
@@ -2,11 +2,14 @@
 #define PE_LINSYS_H
 
 #include <petscksp.h>
+#include <vector>
 
 namespace apf {class DynamicVector;}
 
 namespace pe {
 
+class TwoLevelSchwarz;
+
 class LinSys
 {
   public:
@@ -15,16 +18,40 @@ class LinSys
     void setToVector(int sz, long* rows, double* vals);
     void addToVector(int sz, long* rows, double* vals);
     void addToMatrix(int sz, long* rows, double* vals);
+    void addToMatrix(int nr, long* rows, int nc, long* cols, double* vals);
     void zeroToVector(int sz, long* rows);
     void diagMatRow(int sz, long* rows);
+    void beginSynchronize();
+    void endSynchronize();
     void synchronize();
+    void getOwnedRange(long& first, long& last);
+    double getStashBytes();
+    void disableOffProcEntries();
+    void zeroVector();
+    void saveVolumeSystem();
+    void saveVolumeVector();
+    void restoreVolumeSystem(bool matrix);
+    void reusePreconditioner(bool reuse);
+    void useTwoLevelSchwarz(std::vector<long>& subdomain);
     void solve();
+    int getIterations();
+    void printMatrixUsage();
+    void beginScratch();
+    void endScratch();
+    void measureMatMult(int n);
     void getSolution(apf::DynamicVector& x);
   private:
     Mat A;
     Vec x;
     Vec b;
+    Mat A0;
+    Vec b0;
+    Mat scratchA;
+    Vec scratchB;
     KSP solver;
+    bool preconditioned;
+    bool reusing;
+    TwoLevelSchwarz* schwarz;
 };
 
 }
@@ -1,6 +1,9 @@
 #include "app.h"
 #include "utils.h"
+#include "memory.h"
 #include "bd_cond.h" 
+#include "problem.h"
+#include "server.h"
 #include <petscsys.h>
 #include <apf.h>
 #include <apfShape.h>
@@ -10,25 +13,10 @@
 #include <PCU.h>
 #include <cmath>
 #include <functional>
+#include <sstream>
 
 namespace {
 
-//auto bd_condition = [](apf::Vector3 const& p)->BoundaryType{ return (p[0]>1.-1.e-12)?(NEUMANN):(DIRICHLET) ; };
-auto bd_condition = [](apf::Vector3 const& p)->BoundaryType{ return DIRICHLET; };
-
-auto g_neu = [](apf::Vector3 const& p)->double{ return 1.; };
-
-auto g_dir = [](apf::Vector3 const& p)->double{ return 0.; };
-// auto g_dir = [](apf::Vector3 const& p)->double{ return  (p[0]>1.-1.e-12)?(1):(0) ; };
-
-// auto rhs    = [](apf::Vector3 const& p)->double{ return 2.*(p[0]*(1.-p[0])+p[1]*(1.-p[1])); };
-// auto rhs = [](apf::Vector3 const& p)->double{ return 1.; };
-// auto rhs = [](apf::Vector3 const& p)->double{ return std::sin(2*M_PI*p[0])*std::sin(2*M_PI*p[1]); };
-
-// This RHS corresponds to the exact solution u(x,y) = x^4*(1-x)*y*(1-y)
-auto rhs = [](apf::Vector3 const& p)->double{ return -1.; };
-
-
 void initialize()
 {
   MPI_Init(0,0);
@@ -49,17 +37,49 @@ void finalize()
 
 int main(int argc, char** argv)
 {
-  ASSERT(argc == 4);
+  ASSERT(argc >= 4);
   const char* geom = argv[1];
   const char* mesh = argv[2];
   const char* out = argv[3];
-  const int fem_ord = 2;
-  const int integr_ord = 2;  
   initialize();
+  pe::Problem problem;
+  if (argc > 4)
+    problem.load(argv[4]);
   gmi_register_mesh();
+  double m0 = pe::getMemoryUsage();
   apf::Mesh2* m = apf::loadMdsMesh(geom, mesh);
-  pe::App app(m, fem_ord, integr_ord, bd_condition, g_neu, g_dir, rhs, out);
-  app.run();
+  pe::recordMemory("mesh (RSS estimate)", pe::getMemoryUsage()-m0);
+  {
+    pe::App app(m, problem.femOrder, problem.integrationOrder,
+        problem.getBoundaryCondition(), problem.gNeu, problem.gDir,
+        problem.rhs, out);
+    std::string spool;
+    bool serving = pe::getStringOption("-pe_serve", spool);
+    if (serving)
+      pe::checkServe(spool.c_str());
+    if (argc > 5 || serving)
+      app.enableUpdates();
+    app.run();
+    // further problem files only change the source and boundary data,
+    // out_1, out_2...
+    pe::Problem current = problem;
+    for (int i=5; i < argc; ++i)
+    {
+      pe::Problem next = problem;
+      next.load(argv[i]);
+      if ( ! next.hasSameOrders(problem))
+        pe::fail("%s: the orders may not differ from %s", argv[i], argv[4]);
+      if (next.rhs.getSource() != current.rhs.getSource())
+        app.setSource(next.rhs);
+      std::stringstream name;
+      name << out << '_' << i-4;
+      app.update(next.getBoundaryCondition(), next.gNeu, next.gDir,
+          name.str().c_str());
+      current = next;
+    }
+    if (serving)
+      pe::serve(app, problem, current, spool.c_str());
+  }
   m->destroyNative();
   apf::destroyMesh(m);
   finalize();
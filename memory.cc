@@ -0,0 +1,82 @@
+#include "memory.h"
+#include "utils.h"
+#include <petscsys.h>
+#include <PCU.h>
+#include <apfMesh.h>
+#include <apfShape.h>
+#include <string>
+#include <vector>
+
+namespace pe {
+
+struct MemoryRecord
+{
+  std::string what;
+  double bytes;
+};
+
+static std::vector<MemoryRecord> records;
+
+// resident set size of this process, in bytes
+double getMemoryUsage()
+{
+  PetscLogDouble rss;
+  CALL( PetscMemoryGetCurrentUsage(&rss) );
+  return rss;
+}
+
+// A global numbering tags every entity that holds nodes with one long per
+// node, plus a byte marking the tag as set. Freed heap memory rarely goes
+// back to the system, so numberings are charged by this size rather than
+// by the resident set size.
+double getNumberingBytes(apf::Mesh* m, apf::FieldShape* s)
+{
+  double bytes = 0;
+  for (int d=0; d <= m->getDimension(); ++d)
+  {
+    if ( ! s->hasNodesIn(d))
+      continue;
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(d);
+    while ((e = m->iterate(it)))
+      bytes += s->countNodesOn(m->getType(e)) * sizeof(long) + 1;
+    m->end(it);
+  }
+  return bytes;
+}
+
+// charge bytes to the structure named what, accumulating over calls.
+// every rank has to record the same structures in the same order.
+void recordMemory(const char* what, double bytes)
+{
+  for (std::size_t i=0; i < records.size(); ++i)
+    if (records[i].what == what)
+    {
+      records[i].bytes += bytes;
+      return;
+    }
+  MemoryRecord r = {what, bytes};
+  records.push_back(r);
+}
+
+static void printMemoryLine(const char* what, double bytes)
+{
+  const double MB = 1024.0 * 1024.0;
+  double lo = bytes / MB;
+  double hi = lo;
+  double sum = lo;
+  PCU_Min_Doubles(&lo, 1);
+  PCU_Max_Doubles(&hi, 1);
+  PCU_Add_Doubles(&sum, 1);
+  print("  %-34s %10.1f %10.1f %12.1f", what, lo, hi, sum);
+}
+
+void printMemoryReport()
+{
+  print("  %-34s %10s %10s %12s", "memory (MB)", "rank min", "rank max", "total");
+  for (std::size_t i=0; i < records.size(); ++i)
+    printMemoryLine(records[i].what.c_str(), records[i].bytes);
+  printMemoryLine("resident set size", getMemoryUsage());
+}
+
+}
@@ -0,0 +1,18 @@
+#ifndef PE_MEMORY_H
+#define PE_MEMORY_H
+
+namespace apf {
+class Mesh;
+class FieldShape;
+}
+
+namespace pe {
+
+double getMemoryUsage();
+double getNumberingBytes(apf::Mesh* m, apf::FieldShape* s);
+void recordMemory(const char* what, double bytes);
+void printMemoryReport();
+
+}
+
+#endif
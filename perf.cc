@@ -0,0 +1,224 @@
+#include "perf.h"
+#include "utils.h"
+#include <petscsys.h>
+#include <PCU.h>
+#include <algorithm>
+#include <cstdio>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace pe {
+
+static const char* const names[PERF_RECORDS] = {
+  "integrate", "scatter", "spmv", "assemble phase", "solve phase"};
+
+struct PerfTotal
+{
+  double calls;
+  PerfSample sum;
+};
+
+static PerfTotal totals[PERF_RECORDS];
+static int enabled = -1;
+static bool counting = false;
+// flops passed to recordPerf and countFlops so far, which phases add to
+// those of PETSc
+static double counted = 0;
+
+#ifdef __linux__
+static int group = -1;
+
+static int openCounter(unsigned long long config, int leader)
+{
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = (leader == -1);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP |
+                     PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+// one group so that the three counters are always scheduled together,
+// the file descriptors are closed at exit unless one fails to open
+static bool openCounters()
+{
+  const unsigned long long events[3] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES};
+  int fds[3];
+  for (int i=0; i < 3; ++i)
+  {
+    fds[i] = openCounter(events[i], i ? fds[0] : -1);
+    if (fds[i] >= 0)
+      continue;
+    for (int j=0; j < i; ++j)
+      close(fds[j]);
+    return false;
+  }
+  group = fds[0];
+  ioctl(group, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+// counts are scaled up if the kernel had to multiplex the group
+static void readGroup(PerfSample& s)
+{
+  unsigned long long buf[6];
+  if (read(group, buf, sizeof(buf)) != ssize_t(sizeof(buf)) || ! buf[2])
+    return;
+  double scale = double(buf[1]) / double(buf[2]);
+  s.cycles = buf[3] * scale;
+  s.instructions = buf[4] * scale;
+  s.misses = buf[5] * scale;
+}
+#else
+static bool openCounters()
+{
+  return false;
+}
+#endif
+
+// -pe_perf, read once. Not collective: a rank may first get here from
+// an element loop.
+bool perfEnabled()
+{
+  if (enabled < 0)
+  {
+    enabled = getBoolOption("-pe_perf");
+    if (enabled)
+      counting = openCounters();
+  }
+  return enabled;
+}
+
+// Without -pe_perf this returns zeros and costs a branch. The flops are
+// those counted so far by recordPerf and by PETSc.
+PerfSample readCounters()
+{
+  PerfSample s = {0, 0, 0, 0, 0};
+  if ( ! perfEnabled())
+    return s;
+  s.seconds = PCU_Time();
+  PetscLogDouble petsc;
+  CALL( PetscGetFlops(&petsc) );
+  s.flops = counted + petsc;
+#ifdef __linux__
+  if (counting)
+    readGroup(s);
+#endif
+  return s;
+}
+
+static void accumulate(PerfRecord what, PerfSample const& start,
+    PerfSample const& now, double flops)
+{
+  PerfTotal& t = totals[what];
+  t.calls += 1;
+  t.sum.seconds += now.seconds - start.seconds;
+  t.sum.cycles += now.cycles - start.cycles;
+  t.sum.instructions += now.instructions - start.instructions;
+  t.sum.misses += now.misses - start.misses;
+  t.sum.flops += flops;
+}
+
+// a kernel whose flops the caller counts
+void recordPerf(PerfRecord what, PerfSample const& start, double flops)
+{
+  if ( ! perfEnabled())
+    return;
+  accumulate(what, start, readCounters(), flops);
+  counted += flops;
+}
+
+// a phase, charged with the flops of its kernels and of PETSc
+void recordPerf(PerfRecord what, PerfSample const& start)
+{
+  if ( ! perfEnabled())
+    return;
+  PerfSample now = readCounters();
+  accumulate(what, start, now, now.flops - start.flops);
+}
+
+// flops done outside any recorded kernel, which only phases are charged
+// with, e.g. a whole assembly loop's counted once it ends
+void countFlops(double flops)
+{
+  if (perfEnabled())
+    counted += flops;
+}
+
+static double getPeak(const char* name)
+{
+  double value = 0;
+  getRealOption(name, value);
+  return value;
+}
+
+/* Bytes are estimated as one 64 byte line per last level cache miss.
+   Rates divide the flops and bytes of all ranks by the slowest rank's
+   time. Given the machine peaks -pe_perf_peak_gflops and
+   -pe_perf_peak_gbs for all the ranks together, each record is bound by
+   memory if its intensity is below their ratio, and its share of the
+   roofline min(peak flops, intensity * peak bandwidth) is printed. */
+void printPerfReport()
+{
+  if ( ! perfEnabled())
+    return;
+  int counters = PCU_Min_Int(counting);
+  double peakFlops = getPeak("-pe_perf_peak_gflops") * 1e9;
+  double peakBytes = getPeak("-pe_perf_peak_gbs") * 1e9;
+  if ( ! counters)
+    print("hardware counters unavailable on some rank, "
+        "check /proc/sys/kernel/perf_event_paranoid");
+  print("  %-16s %10s %9s %5s %9s %8s %9s %8s", "roofline", "seconds",
+      "GFLOP/s", "IPC", "LLC MB", "GB/s", "flop/byte", "bound");
+  for (int i=0; i < PERF_RECORDS; ++i)
+  {
+    PerfSample s = totals[i].sum;
+    double calls = totals[i].calls;
+    PCU_Add_Doubles(&calls, 1);
+    if ( ! calls)
+      continue;
+    PCU_Max_Doubles(&s.seconds, 1);
+    PCU_Add_Doubles(&s.cycles, 1);
+    PCU_Add_Doubles(&s.instructions, 1);
+    PCU_Add_Doubles(&s.misses, 1);
+    PCU_Add_Doubles(&s.flops, 1);
+    double time = s.seconds > 0 ? s.seconds : 1;
+    double bytes = s.misses * 64;
+    double flopRate = s.flops / time;
+    if ( ! counters)
+    {
+      print("  %-16s %10.4f %9.3f", names[i], s.seconds, flopRate / 1e9);
+      continue;
+    }
+    double intensity = bytes > 0 ? s.flops / bytes : 0;
+    char bound[16] = "-";
+    if (peakFlops > 0 && peakBytes > 0 && bytes > 0)
+    {
+      double roof = std::min(peakFlops, intensity * peakBytes);
+      std::snprintf(bound, sizeof(bound), "%s %.0f%%",
+          intensity < peakFlops / peakBytes ? "mem" : "cpu",
+          100 * flopRate / roof);
+    }
+    print("  %-16s %10.4f %9.3f %5.2f %9.1f %8.2f %9.3f %8s", names[i],
+        s.seconds, flopRate / 1e9,
+        s.cycles > 0 ? s.instructions / s.cycles : 0,
+        bytes / (1024 * 1024), bytes / time / 1e9, intensity, bound);
+  }
+}
+
+}
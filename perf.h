@@ -0,0 +1,37 @@
+#ifndef PE_PERF_H
+#define PE_PERF_H
+
+namespace pe {
+
+/* Hardware counters read around kernels and phases when -pe_perf is set,
+   through perf_event_open on Linux. Records are indexed by PerfRecord so
+   that every rank reports the same ones, even if it never ran one. */
+enum PerfRecord
+{
+  PERF_INTEGRATE,
+  PERF_SCATTER,
+  PERF_SPMV,
+  PERF_ASSEMBLE,
+  PERF_SOLVE,
+  PERF_RECORDS
+};
+
+struct PerfSample
+{
+  double seconds;
+  double cycles;
+  double instructions;
+  double misses;
+  double flops;
+};
+
+bool perfEnabled();
+PerfSample readCounters();
+void recordPerf(PerfRecord what, PerfSample const& start, double flops);
+void recordPerf(PerfRecord what, PerfSample const& start);
+void countFlops(double flops);
+void printPerfReport();
+
+}
+
+#endif
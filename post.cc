@@ -1,8 +1,10 @@
 #include "app.h"
 #include "linsys.h"
 #include "utils.h"
+#include "probe.h"
 #include <apf.h>
 #include <apfNumbering.h>
+#include <apfShape.h>
 #include <apfDynamicVector.h>
 #include <PCU.h>
 
@@ -14,12 +16,49 @@ static void cleanup(
     apf::GlobalNumbering* s,
     LinSys* ls)
 {
-  apf::destroyField(f);
-  apf::destroyGlobalNumbering(o);
-  apf::destroyGlobalNumbering(s);
+  if (f)
+    apf::destroyField(f);
+  if (o)
+    apf::destroyGlobalNumbering(o);
+  if (s)
+    apf::destroyGlobalNumbering(s);
   delete ls;
 }
 
+// Visits the owned nodes in the order apf::numberOwnedNodes numbered them,
+// so the lean mode can place the solution without any numbering.
+static void attachOwnedSolution(
+    apf::Mesh* m,
+    apf::Field* f,
+    LinSys* ls)
+{
+  apf::DynamicVector x;
+  ls->getSolution(x);
+  apf::FieldShape* s = apf::getShape(f);
+  std::size_t i = 0;
+  for (int d=0; d <= m->getDimension(); ++d)
+  {
+    if ( ! s->hasNodesIn(d))
+      continue;
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(d);
+    while ((e = m->iterate(it)))
+    {
+      if ( ! m->isOwned(e))
+        continue;
+      int nn = s->countNodesOn(m->getType(e));
+      for (int j=0; j < nn; ++j)
+      {
+        ASSERT(i < x.getSize());
+        apf::setScalar(f, e, j, x[i++]);
+      }
+    }
+    m->end(it);
+  }
+  ASSERT(i == x.getSize());
+  apf::synchronize(f);
+}
+
 static void attachSolution(
     apf::Field* f,
     apf::GlobalNumbering* n,
@@ -37,8 +76,22 @@ static void attachSolution(
 
 void App::post()
 {
-  attachSolution(sol, owned, linsys);
-  apf::writeVtkFiles(out, mesh);
+  if (lean)
+    attachOwnedSolution(mesh, sol, linsys);
+  else
+    attachSolution(sol, owned, linsys);
+  apf::writeVtkFiles(out.c_str(), mesh);
+  if (probesRequested())
+  {
+    if ( ! locator)
+      locator = new PointLocator(mesh, sol);
+    runProbes(*locator, out.c_str());
+  }
+}
+
+App::~App()
+{
+  delete locator;
   cleanup(sol, owned, shared, linsys);
 }
 
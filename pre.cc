@@ -1,8 +1,15 @@
 #include "app.h"
 #include "linsys.h"
+#include "memory.h"
+#include "utils.h"
 #include <apf.h>
+#include <apfShape.h>
 #include <apfNumbering.h>
+#include <apfMesh2.h>
 #include <PCU.h>
+#include <algorithm>
+#include <set>
+#include <vector>
 
 namespace pe {
 
@@ -30,15 +37,82 @@ static long countTotalNodes(int n)
   return N;
 }
 
+// The overlapping subdomain of the two-level Schwarz preconditioner: the
+// nodes of this part's elements, owned or not, plus one layer of elements
+// from the neighbouring parts. Each element with a vertex on the part
+// boundary sends its node numbers to the other parts sharing that vertex.
+static std::vector<long> getPartRows(apf::Mesh* m, apf::GlobalNumbering* n)
+{
+  apf::DynamicArray<apf::Node> nodes;
+  apf::getNodes(n, nodes);
+  std::vector<long> rows(nodes.getSize());
+  for (std::size_t i=0; i < nodes.getSize(); ++i)
+    rows[i] = apf::getNumber(n, nodes[i]);
+  PCU_Comm_Begin();
+  apf::MeshEntity* e;
+  apf::MeshIterator* it = m->begin(m->getDimension());
+  while ((e = m->iterate(it)))
+  {
+    apf::Downward verts;
+    int nv = m->getDownward(e, 0, verts);
+    std::set<int> parts;
+    for (int i=0; i < nv; ++i)
+    {
+      if ( ! m->isShared(verts[i]))
+        continue;
+      apf::Copies remotes;
+      m->getRemotes(verts[i], remotes);
+      APF_ITERATE(apf::Copies, remotes, rit)
+        parts.insert(rit->first);
+    }
+    if (parts.empty())
+      continue;
+    apf::NewArray<long> numbers;
+    int sz = apf::getElementNumbers(n, e, numbers);
+    APF_ITERATE(std::set<int>, parts, pit)
+    {
+      PCU_COMM_PACK(*pit, sz);
+      PCU_Comm_Pack(*pit, &numbers[0], sz * sizeof(long));
+    }
+  }
+  m->end(it);
+  PCU_Comm_Send();
+  while (PCU_Comm_Receive())
+  {
+    int sz;
+    PCU_COMM_UNPACK(sz);
+    std::size_t k = rows.size();
+    rows.resize(k + sz);
+    PCU_Comm_Unpack(&rows[k], sz * sizeof(long));
+  }
+  std::sort(rows.begin(), rows.end());
+  rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+  return rows;
+}
+
+// In lean mode the owned numbering is not created: before synchronization
+// the shared numbering holds exactly the same numbers.
 void App::pre()
 {
+  lean = getBoolOption("-pe_lean_numbering");
+  ownerComputes = getBoolOption("-pe_owner_computes");
+  double m0 = getMemoryUsage();
   sol = createSolutionField(mesh, polynomialOrder);
-  owned = createNumbering(mesh, sol, "owned");
+  recordMemory("field (RSS estimate)", getMemoryUsage()-m0);
+  owned = lean ? 0 : createNumbering(mesh, sol, "owned");
   shared = createNumbering(mesh, sol, "shared");
+  int n = apf::countNodes(lean ? shared : owned);
   apf::synchronize(shared);
-  int n = apf::countNodes(owned);
+  double bytes = getNumberingBytes(mesh, apf::getShape(sol));
+  recordMemory("numberings", lean ? bytes : 2 * bytes);
+  bool schwarz = getBoolOption("-pe_two_level_schwarz");
+  std::vector<long> subdomain;
+  if (schwarz)
+    subdomain = getPartRows(mesh, shared);
   long N = countTotalNodes(n);
   linsys = new LinSys(n,N);
+  if (schwarz)
+    linsys->useTwoLevelSchwarz(subdomain);
 }
 
 }
@@ -0,0 +1,421 @@
+#include "probe.h"
+#include "utils.h"
+#include <apf.h>
+#include <apfMesh.h>
+#include <petscsys.h>
+#include <PCU.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+
+namespace pe {
+
+// elements per leaf of the hierarchy
+static const int leafSize = 8;
+
+void PointLocator::Box::include(double const* p)
+{
+  for (int i=0; i < 3; ++i)
+  {
+    lo[i] = std::min(lo[i], p[i]);
+    hi[i] = std::max(hi[i], p[i]);
+  }
+}
+
+void PointLocator::Box::include(Box const& b)
+{
+  include(b.lo);
+  include(b.hi);
+}
+
+bool PointLocator::Box::contains(double const* p, double tol) const
+{
+  for (int i=0; i < 3; ++i)
+    if (p[i] < lo[i] - tol || p[i] > hi[i] + tol)
+      return false;
+  return true;
+}
+
+static void makeEmpty(double* lo, double* hi)
+{
+  for (int i=0; i < 3; ++i)
+  {
+    lo[i] = std::numeric_limits<double>::max();
+    hi[i] = -std::numeric_limits<double>::max();
+  }
+}
+
+PointLocator::PointLocator(apf::Mesh* m, apf::Field* f) :
+  mesh(m),
+  field(f),
+  dim(m->getDimension())
+{
+  double t0 = PCU_Time();
+  Box all;
+  makeEmpty(all.lo, all.hi);
+  apf::MeshEntity* e;
+  apf::MeshIterator* it = m->begin(dim);
+  while ((e = m->iterate(it)))
+  {
+    apf::Downward verts;
+    int nv = m->getDownward(e, 0, verts);
+    ASSERT(nv == dim + 1);
+    Box b;
+    makeEmpty(b.lo, b.hi);
+    for (int i=0; i < nv; ++i)
+    {
+      apf::Vector3 x;
+      m->getPoint(verts[i], 0, x);
+      double c[3] = {x[0], x[1], x[2]};
+      corners.insert(corners.end(), c, c + 3);
+      b.include(c);
+    }
+    elements.push_back(e);
+    boxes.push_back(b);
+    all.include(b);
+  }
+  m->end(it);
+  int n = elements.size();
+  for (int i=0; i < n; ++i)
+    order.push_back(i);
+  if (n)
+    build(0, n);
+  double size = 0;
+  for (int i=0; i < 3 && n; ++i)
+    size = std::max(size, all.hi[i] - all.lo[i]);
+  PCU_Max_Doubles(&size, 1);
+  tolerance = 1e-10 * size;
+  parts.resize(PCU_Comm_Peers());
+  MPI_Allgather(&all, 6, MPI_DOUBLE, &parts[0], 6, MPI_DOUBLE, MPI_COMM_WORLD);
+  double t1 = PCU_Time();
+  print("point locator built in %f seconds", t1-t0);
+}
+
+// Median split along the longest axis of the node's box
+int PointLocator::build(int begin, int end)
+{
+  Node node;
+  makeEmpty(node.box.lo, node.box.hi);
+  for (int i=begin; i < end; ++i)
+    node.box.include(boxes[order[i]]);
+  node.begin = begin;
+  node.end = end;
+  node.left = node.right = -1;
+  int index = nodes.size();
+  nodes.push_back(node);
+  if (end - begin <= leafSize)
+    return index;
+  int axis = 0;
+  for (int i=1; i < 3; ++i)
+    if (node.box.hi[i] - node.box.lo[i] > node.box.hi[axis] - node.box.lo[axis])
+      axis = i;
+  std::vector<Box> const& b = boxes;
+  int mid = (begin + end) / 2;
+  std::nth_element(order.begin() + begin, order.begin() + mid,
+      order.begin() + end, [&b, axis](int x, int y) {
+        return b[x].lo[axis] + b[x].hi[axis] < b[y].lo[axis] + b[y].hi[axis];
+      });
+  int left = build(begin, mid);
+  int right = build(mid, end);
+  nodes[index].left = left;
+  nodes[index].right = right;
+  return index;
+}
+
+// Barycentric coordinates of p in a straight-sided simplex, which are the
+// parametric coordinates of APF simplices
+bool PointLocator::findIn(int element, double const* p, apf::Vector3& xi)
+{
+  double const* v = &corners[element * (dim + 1) * 3];
+  double J[3][3];
+  double r[3];
+  for (int i=0; i < dim; ++i)
+  {
+    r[i] = p[i] - v[i];
+    for (int j=0; j < dim; ++j)
+      J[i][j] = v[(j + 1) * 3 + i] - v[i];
+  }
+  double s[3] = {0, 0, 0};
+  if (dim == 2)
+  {
+    double det = J[0][0] * J[1][1] - J[0][1] * J[1][0];
+    if (det == 0)
+      return false;
+    s[0] = (r[0] * J[1][1] - J[0][1] * r[1]) / det;
+    s[1] = (J[0][0] * r[1] - r[0] * J[1][0]) / det;
+  }
+  else
+  {
+    double det = 0;
+    for (int k=0; k < 3; ++k)
+      det += J[0][k] * (J[1][(k+1)%3] * J[2][(k+2)%3] -
+                        J[1][(k+2)%3] * J[2][(k+1)%3]);
+    if (det == 0)
+      return false;
+    for (int c=0; c < 3; ++c)
+    {
+      double M[3][3];
+      for (int i=0; i < 3; ++i)
+        for (int j=0; j < 3; ++j)
+          M[i][j] = (j == c) ? r[i] : J[i][j];
+      double d = 0;
+      for (int k=0; k < 3; ++k)
+        d += M[0][k] * (M[1][(k+1)%3] * M[2][(k+2)%3] -
+                        M[1][(k+2)%3] * M[2][(k+1)%3]);
+      s[c] = d / det;
+    }
+  }
+  const double tol = 1e-10;
+  double sum = 0;
+  for (int i=0; i < dim; ++i)
+  {
+    if (s[i] < -tol)
+      return false;
+    sum += s[i];
+  }
+  if (sum > 1 + tol)
+    return false;
+  xi = apf::Vector3(s[0], s[1], s[2]);
+  return true;
+}
+
+bool PointLocator::findLocal(apf::Vector3 const& p, double& value)
+{
+  if (nodes.empty())
+    return false;
+  double x[3] = {p[0], p[1], p[2]};
+  std::vector<int> stack(1, 0);
+  while ( ! stack.empty())
+  {
+    Node const& n = nodes[stack.back()];
+    stack.pop_back();
+    if ( ! n.box.contains(x, tolerance))
+      continue;
+    if (n.left >= 0)
+    {
+      stack.push_back(n.left);
+      stack.push_back(n.right);
+      continue;
+    }
+    for (int i=n.begin; i < n.end; ++i)
+    {
+      apf::Vector3 xi;
+      if ( ! findIn(order[i], x, xi))
+        continue;
+      apf::MeshElement* me = apf::createMeshElement(mesh, elements[order[i]]);
+      apf::Element* fe = apf::createElement(field, me);
+      value = apf::getScalar(fe, xi);
+      apf::destroyElement(fe);
+      apf::destroyMeshElement(me);
+      return true;
+    }
+  }
+  return false;
+}
+
+void PointLocator::probe(int n, apf::Vector3 const* points, double* values)
+{
+  int peers = PCU_Comm_Peers();
+  PCU_Comm_Begin();
+  for (int i=0; i < n; ++i)
+  {
+    double x[3] = {points[i][0], points[i][1], points[i][2]};
+    for (int r=0; r < peers; ++r)
+      if (parts[r].contains(x, tolerance))
+      {
+        PCU_COMM_PACK(r, i);
+        PCU_COMM_PACK(r, points[i]);
+      }
+  }
+  PCU_Comm_Send();
+  std::vector<int> from;
+  std::vector<int> ids;
+  std::vector<double> found;
+  while (PCU_Comm_Receive())
+  {
+    int i;
+    apf::Vector3 p;
+    PCU_COMM_UNPACK(i);
+    PCU_COMM_UNPACK(p);
+    double v;
+    if (findLocal(p, v))
+    {
+      from.push_back(PCU_Comm_Sender());
+      ids.push_back(i);
+      found.push_back(v);
+    }
+  }
+  std::fill(values, values + n, std::numeric_limits<double>::quiet_NaN());
+  PCU_Comm_Begin();
+  for (std::size_t k=0; k < ids.size(); ++k)
+  {
+    PCU_COMM_PACK(from[k], ids[k]);
+    PCU_COMM_PACK(from[k], found[k]);
+  }
+  PCU_Comm_Send();
+  while (PCU_Comm_Receive())
+  {
+    int i;
+    double v;
+    PCU_COMM_UNPACK(i);
+    PCU_COMM_UNPACK(v);
+    if (std::isnan(values[i]))
+      values[i] = v;
+  }
+}
+
+// this rank's share [first, first+n) of total queries
+static void getSlice(long total, long& first, int& n)
+{
+  int self = PCU_Comm_Self();
+  int peers = PCU_Comm_Peers();
+  first = total * self / peers;
+  n = int(total * (self + 1) / peers - first);
+}
+
+// Output: the number of points as a 64-bit integer, then one double per
+// point in query order
+static void probeAndWrite(
+    PointLocator& locator,
+    long first,
+    long total,
+    std::vector<apf::Vector3>& points,
+    std::string const& path)
+{
+  double t0 = PCU_Time();
+  int n = points.size();
+  std::vector<double> values(n);
+  locator.probe(n, points.data(), values.data());
+  long missed = 0;
+  for (int i=0; i < n; ++i)
+    if (std::isnan(values[i]))
+      ++missed;
+  PCU_Add_Longs(&missed, 1);
+  MPI_File file;
+  if (MPI_File_open(MPI_COMM_WORLD, const_cast<char*>(path.c_str()),
+        MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file))
+    fail("could not open %s", path.c_str());
+  MPI_File_set_size(file, 0);
+  long long header = total;
+  if ( ! PCU_Comm_Self())
+    MPI_File_write_at(file, 0, &header, 1, MPI_LONG_LONG, MPI_STATUS_IGNORE);
+  MPI_Offset offset = sizeof(header) + first * sizeof(double);
+  MPI_File_write_at_all(file, offset, values.data(), n, MPI_DOUBLE,
+      MPI_STATUS_IGNORE);
+  MPI_File_close(&file);
+  double t1 = PCU_Time();
+  print("probed %ld points into %s in %f seconds, %ld outside the mesh",
+      total, path.c_str(), t1-t0, missed);
+}
+
+// -pe_probe_file: raw doubles x,y,z per point, each rank reads its share
+static void probeFile(PointLocator& locator, const char* in, std::string out)
+{
+  FILE* file = std::fopen(in, "rb");
+  if ( ! file)
+    fail("could not open probe file %s", in);
+  std::fseek(file, 0, SEEK_END);
+  long total = std::ftell(file) / (3 * sizeof(double));
+  long first;
+  int n;
+  getSlice(total, first, n);
+  std::vector<double> xyz(3 * n);
+  std::fseek(file, first * 3 * sizeof(double), SEEK_SET);
+  if (std::fread(xyz.data(), sizeof(double), xyz.size(), file) != xyz.size())
+    fail("could not read probe file %s", in);
+  std::fclose(file);
+  std::vector<apf::Vector3> points(n);
+  for (int i=0; i < n; ++i)
+    points[i] = apf::Vector3(xyz[3*i], xyz[3*i+1], xyz[3*i+2]);
+  probeAndWrite(locator, first, total, points, out + "_probes.bin");
+}
+
+// -pe_probe_line x0,y0,z0,x1,y1,z1,n: n points from the first end to the
+// second, both included
+static void probeLine(PointLocator& locator, double* a, std::string out)
+{
+  long total = long(a[6]);
+  ASSERT(total > 1);
+  long first;
+  int n;
+  getSlice(total, first, n);
+  std::vector<apf::Vector3> points(n);
+  for (int i=0; i < n; ++i)
+  {
+    double t = double(first + i) / (total - 1);
+    points[i] = apf::Vector3(a[0] + t * (a[3] - a[0]),
+                             a[1] + t * (a[4] - a[1]),
+                             a[2] + t * (a[5] - a[2]));
+  }
+  probeAndWrite(locator, first, total, points, out + "_line.bin");
+}
+
+// -pe_probe_plane ox,oy,oz,ux,uy,uz,vx,vy,vz,nu,nv: the nu by nv grid
+// o + s*u + t*v for s and t in [0,1], s varying fastest
+static void probePlane(PointLocator& locator, double* a, std::string out)
+{
+  long nu = long(a[9]);
+  long nv = long(a[10]);
+  ASSERT(nu > 1 && nv > 1);
+  long total = nu * nv;
+  long first;
+  int n;
+  getSlice(total, first, n);
+  std::vector<apf::Vector3> points(n);
+  for (int i=0; i < n; ++i)
+  {
+    double s = double((first + i) % nu) / (nu - 1);
+    double t = double((first + i) / nu) / (nv - 1);
+    points[i] = apf::Vector3(a[0] + s * a[3] + t * a[6],
+                             a[1] + s * a[4] + t * a[7],
+                             a[2] + s * a[5] + t * a[8]);
+  }
+  probeAndWrite(locator, first, total, points, out + "_plane.bin");
+}
+
+bool probesRequested()
+{
+  const char* names[] = {"-pe_probe_file", "-pe_probe_line", "-pe_probe_plane"};
+  for (int i=0; i < 3; ++i)
+  {
+    PetscBool set;
+    CALL( PetscOptionsHasName(PETSC_NULL, PETSC_NULL, names[i], &set) );
+    if (set)
+      return true;
+  }
+  return false;
+}
+
+void runProbes(PointLocator& locator, const char* out)
+{
+  PetscBool set;
+  char path[PETSC_MAX_PATH_LEN];
+  CALL( PetscOptionsGetString(PETSC_NULL, PETSC_NULL, "-pe_probe_file",
+        path, sizeof(path), &set) );
+  if (set)
+    probeFile(locator, path, out);
+  PetscReal line[7];
+  PetscInt n = 7;
+  CALL( PetscOptionsGetRealArray(PETSC_NULL, PETSC_NULL, "-pe_probe_line",
+        line, &n, &set) );
+  if (set)
+  {
+    if (n != 7)
+      fail("-pe_probe_line takes x0,y0,z0,x1,y1,z1,n");
+    probeLine(locator, line, out);
+  }
+  PetscReal plane[11];
+  n = 11;
+  CALL( PetscOptionsGetRealArray(PETSC_NULL, PETSC_NULL, "-pe_probe_plane",
+        plane, &n, &set) );
+  if (set)
+  {
+    if (n != 11)
+      fail("-pe_probe_plane takes ox,oy,oz,ux,uy,uz,vx,vy,vz,nu,nv");
+    probePlane(locator, plane, out);
+  }
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef PE_PROBE_H
+#define PE_PROBE_H
+
+#include <vector>
+
+namespace apf {
+class Mesh;
+class Field;
+class MeshEntity;
+class Vector3;
+}
+
+namespace pe {
+
+/* Finds the element containing a point with a bounding volume hierarchy
+   over the local elements, built once. Elements are assumed to be
+   straight-sided simplices, the field is evaluated with its own shape
+   functions. probe() is collective: each point is sent to the ranks whose
+   part bounding box holds it, and its value comes back (NaN if no rank
+   found it). */
+class PointLocator
+{
+  public:
+    PointLocator(apf::Mesh* m, apf::Field* f);
+    void probe(int n, apf::Vector3 const* points, double* values);
+  private:
+    struct Box
+    {
+      double lo[3];
+      double hi[3];
+      void include(double const* p);
+      void include(Box const& b);
+      bool contains(double const* p, double tol) const;
+    };
+    struct Node
+    {
+      Box box;
+      int begin;
+      int end;
+      int left;
+      int right;
+    };
+    int build(int begin, int end);
+    bool findLocal(apf::Vector3 const& p, double& value);
+    bool findIn(int element, double const* p, apf::Vector3& xi);
+    apf::Mesh* mesh;
+    apf::Field* field;
+    int dim;
+    double tolerance;
+    std::vector<apf::MeshEntity*> elements;
+    std::vector<double> corners;
+    std::vector<Box> boxes;
+    std::vector<int> order;
+    std::vector<Node> nodes;
+    std::vector<Box> parts;
+};
+
+bool probesRequested();
+void runProbes(PointLocator& locator, const char* out);
+
+}
+
+#endif
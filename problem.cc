@@ -0,0 +1,154 @@
+#include "problem.h"
+#include "utils.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace pe {
+
+Problem::Problem():
+  femOrder(2),
+  integrationOrder(2),
+  neumann("0"),
+  gNeu("1"),
+  gDir("0"),
+  rhs("-1")
+{
+}
+
+static std::string trim(std::string const& s)
+{
+  const char* space = " \t\r\n";
+  std::size_t b = s.find_first_not_of(space);
+  if (b == std::string::npos)
+    return std::string();
+  std::size_t e = s.find_last_not_of(space);
+  return s.substr(b, e - b + 1);
+}
+
+static bool report(std::string* error, const char* format, ...)
+  __attribute__((format(printf,2,3)));
+
+static bool report(std::string* error, const char* format, ...)
+{
+  char buf[1024];
+  va_list ap;
+  va_start(ap, format);
+  std::vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  if ( ! error)
+    fail("%s", buf);
+  *error = buf;
+  return false;
+}
+
+static bool toOrder(std::string const& v, int& order)
+{
+  char* end;
+  long o = std::strtol(v.c_str(), &end, 10);
+  if (*end || o < 1)
+    return false;
+  order = int(o);
+  return true;
+}
+
+static bool toExpression(std::string const& v, Expression& e,
+    std::string* error)
+{
+  if ( ! error)
+  {
+    e = Expression(v);
+    return true;
+  }
+  std::string message;
+  Expression parsed(v, message);
+  if ( ! message.empty())
+  {
+    *error = message;
+    return false;
+  }
+  e = parsed;
+  return true;
+}
+
+void Problem::load(const char* path)
+{
+  FILE* file = std::fopen(path, "r");
+  if ( ! file)
+    fail("could not open problem file %s", path);
+  std::string text;
+  char buf[4096];
+  std::size_t n;
+  while ((n = std::fread(buf, 1, sizeof(buf), file)))
+    text.append(buf, n);
+  std::fclose(file);
+  parse(text, path, 0);
+}
+
+bool Problem::parse(std::string const& text, const char* name,
+    std::string* error)
+{
+  std::size_t begin = 0;
+  int lineno = 0;
+  while (begin < text.size())
+  {
+    ++lineno;
+    std::size_t newline = text.find('\n', begin);
+    if (newline == std::string::npos)
+      newline = text.size();
+    std::string line = text.substr(begin, newline - begin);
+    begin = newline + 1;
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty())
+      continue;
+    std::size_t eq = line.find('=');
+    if (eq == std::string::npos || line[eq+1] == '=')
+      return report(error, "%s:%d: expected \"key = value\"", name, lineno);
+    std::string key = trim(line.substr(0, eq));
+    std::string value = trim(line.substr(eq + 1));
+    bool ok = true;
+    if (key == "fem_order")
+      ok = toOrder(value, femOrder);
+    else if (key == "integration_order")
+      ok = toOrder(value, integrationOrder);
+    else if (key == "neumann")
+      ok = toExpression(value, neumann, error);
+    else if (key == "g_neu")
+      ok = toExpression(value, gNeu, error);
+    else if (key == "g_dir")
+      ok = toExpression(value, gDir, error);
+    else if (key == "rhs")
+      ok = toExpression(value, rhs, error);
+    else if (key == "out")
+      output = value;
+    else
+      return report(error, "%s:%d: unknown key \"%s\"",
+          name, lineno, key.c_str());
+    if (ok)
+      continue;
+    if (key == "fem_order" || key == "integration_order")
+      return report(error, "%s:%d: %s must be a positive integer, not \"%s\"",
+          name, lineno, key.c_str(), value.c_str());
+    std::string message = *error;
+    return report(error, "%s:%d: %s", name, lineno, message.c_str());
+  }
+  return true;
+}
+
+// true if other can be solved on the same numbering and sparsity
+bool Problem::hasSameOrders(Problem const& other) const
+{
+  return femOrder == other.femOrder &&
+         integrationOrder == other.integrationOrder;
+}
+
+std::function<BoundaryType(apf::Vector3 const&)> Problem::getBoundaryCondition() const
+{
+  Expression n = neumann;
+  return [n](apf::Vector3 const& p)->BoundaryType{
+    return (n(p) != 0.) ? NEUMANN : DIRICHLET;
+  };
+}
+
+}
@@ -0,0 +1,42 @@
+#ifndef PE_PROBLEM_H
+#define PE_PROBLEM_H
+
+#include "bd_cond.h"
+#include "function.h"
+#include <string>
+
+namespace pe {
+
+/* Problem data read from a file of "key = value" lines, '#' starting a
+   comment. The defaults are the problem that used to be hard-coded:
+
+     fem_order = 2
+     integration_order = 2
+     neumann = 0        # boundary facets where this is nonzero
+     g_neu = 1
+     g_dir = 0
+     rhs = -1
+     out =              # output name, only read by -pe_serve requests
+
+   parse() reads the same lines from a string. With error null a bad line
+   is fatal, otherwise its message is stored there and false returned. */
+class Problem
+{
+  public:
+    Problem();
+    void load(const char* path);
+    bool parse(std::string const& text, const char* name, std::string* error);
+    std::function<BoundaryType(apf::Vector3 const&)> getBoundaryCondition() const;
+    bool hasSameOrders(Problem const& other) const;
+    int femOrder;
+    int integrationOrder;
+    Expression neumann;
+    Expression gNeu;
+    Expression gDir;
+    Expression rhs;
+    std::string output;
+};
+
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include "schwarz.h"
+#include "utils.h"
+#include <PCU.h>
+#include <algorithm>
+#include <cmath>
+
+namespace pe {
+
+TwoLevelSchwarz::TwoLevelSchwarz(
+    std::vector<long>& subdomain,
+    long f,
+    long l) :
+  local(PETSC_NULL),
+  first(f),
+  last(l),
+  peers(PCU_Comm_Peers()),
+  self(PCU_Comm_Self())
+{
+  std::sort(subdomain.begin(), subdomain.end());
+  subdomain.erase(std::unique(subdomain.begin(), subdomain.end()),
+      subdomain.end());
+  std::vector<long> rows;
+  for (std::size_t i=0; i < subdomain.size(); ++i)
+    if (first <= subdomain[i] && subdomain[i] < last)
+      rows.push_back(subdomain[i]);
+  ASSERT(long(rows.size()) == last - first);
+  CALL( ISCreateGeneral(PETSC_COMM_SELF, subdomain.size(),
+        (PetscInt*)subdomain.data(), PETSC_COPY_VALUES, &overlapping) );
+  CALL( ISCreateGeneral(PETSC_COMM_SELF, rows.size(),
+        (PetscInt*)rows.data(), PETSC_COPY_VALUES, &owned) );
+}
+
+TwoLevelSchwarz::~TwoLevelSchwarz()
+{
+  if (local)
+    CALL( PCDestroy(&local) );
+  CALL( ISDestroy(&overlapping) );
+  CALL( ISDestroy(&owned) );
+}
+
+void TwoLevelSchwarz::attach(KSP solver)
+{
+  PC pc;
+  CALL( KSPGetPC(solver, &pc) );
+  CALL( PCSetType(pc, PCSHELL) );
+  CALL( PCShellSetContext(pc, this) );
+  CALL( PCShellSetSetUp(pc, setUpShell) );
+  CALL( PCShellSetApply(pc, applyShell) );
+  CALL( PCShellSetName(pc, "two-level additive Schwarz") );
+}
+
+PetscErrorCode TwoLevelSchwarz::setUpShell(PC pc)
+{
+  void* ctx;
+  CALL( PCShellGetContext(pc, &ctx) );
+  Mat A, P;
+  CALL( PCGetOperators(pc, &A, &P) );
+  static_cast<TwoLevelSchwarz*>(ctx)->setUp(P);
+  return 0;
+}
+
+// The first level options take the prefix -pe_schwarz_, for instance
+// -pe_schwarz_sub_pc_type lu or -pe_schwarz_pc_asm_overlap 1 to grow
+// the mesh-based overlap further along the matrix graph.
+void TwoLevelSchwarz::setUp(Mat A)
+{
+  double t0 = PCU_Time();
+  if ( ! local)
+  {
+    CALL( PCCreate(PETSC_COMM_WORLD, &local) );
+    CALL( PCSetOptionsPrefix(local, "pe_schwarz_") );
+    CALL( PCSetType(local, PCASM) );
+    CALL( PCASMSetLocalSubdomains(local, 1, &overlapping, &owned) );
+    CALL( PCASMSetOverlap(local, 0) );
+    CALL( PCSetFromOptions(local) );
+  }
+  CALL( PCSetOperators(local, A, A) );
+  CALL( PCSetUp(local) );
+  buildCoarse(A);
+  double t1 = PCU_Time();
+  print("two-level Schwarz set up in %f seconds, %d coarse unknowns",
+      t1-t0, peers);
+}
+
+// Row self of E = Z^T A Z sums the owned rows of A by owner of the column,
+// then the rows are gathered and E is LU factored on every rank.
+void TwoLevelSchwarz::buildCoarse(Mat A)
+{
+  const PetscInt* ranges;
+  CALL( MatGetOwnershipRanges(A, &ranges) );
+  std::vector<double> row(peers, 0.0);
+  for (PetscInt i=first; i < last; ++i)
+  {
+    PetscInt ncols;
+    const PetscInt* cols;
+    const PetscScalar* vals;
+    CALL( MatGetRow(A, i, &ncols, &cols, &vals) );
+    for (PetscInt j=0; j < ncols; ++j)
+    {
+      int q = std::upper_bound(ranges, ranges + peers + 1, cols[j])
+            - ranges - 1;
+      row[q] += vals[j];
+    }
+    CALL( MatRestoreRow(A, i, &ncols, &cols, &vals) );
+  }
+  coarse.resize(peers * peers);
+  MPI_Allgather(&row[0], peers, MPI_DOUBLE,
+      &coarse[0], peers, MPI_DOUBLE, PETSC_COMM_WORLD);
+  pivots.resize(peers);
+  for (int k=0; k < peers; ++k)
+  {
+    int p = k;
+    for (int i=k+1; i < peers; ++i)
+      if (std::fabs(coarse[i*peers+k]) > std::fabs(coarse[p*peers+k]))
+        p = i;
+    pivots[k] = p;
+    if (p != k)
+      for (int j=0; j < peers; ++j)
+        std::swap(coarse[k*peers+j], coarse[p*peers+j]);
+    double d = coarse[k*peers+k];
+    if (d == 0.0)
+      fail("singular coarse matrix, a rank may own no unknowns");
+    for (int i=k+1; i < peers; ++i)
+    {
+      double l = coarse[i*peers+k] /= d;
+      for (int j=k+1; j < peers; ++j)
+        coarse[i*peers+j] -= l * coarse[k*peers+j];
+    }
+  }
+}
+
+void TwoLevelSchwarz::solveCoarse(std::vector<double>& x)
+{
+  for (int k=0; k < peers; ++k)
+    std::swap(x[k], x[pivots[k]]);
+  for (int i=1; i < peers; ++i)
+    for (int j=0; j < i; ++j)
+      x[i] -= coarse[i*peers+j] * x[j];
+  for (int i=peers-1; i >= 0; --i)
+  {
+    for (int j=i+1; j < peers; ++j)
+      x[i] -= coarse[i*peers+j] * x[j];
+    x[i] /= coarse[i*peers+i];
+  }
+}
+
+PetscErrorCode TwoLevelSchwarz::applyShell(PC pc, Vec r, Vec z)
+{
+  void* ctx;
+  CALL( PCShellGetContext(pc, &ctx) );
+  TwoLevelSchwarz* s = static_cast<TwoLevelSchwarz*>(ctx);
+  CALL( PCApply(s->local, r, z) );
+  PetscInt n;
+  CALL( VecGetLocalSize(r, &n) );
+  const PetscScalar* R;
+  CALL( VecGetArrayRead(r, &R) );
+  double sum = 0;
+  for (PetscInt i=0; i < n; ++i)
+    sum += R[i];
+  CALL( VecRestoreArrayRead(r, &R) );
+  std::vector<double> y(s->peers);
+  MPI_Allgather(&sum, 1, MPI_DOUBLE, &y[0], 1, MPI_DOUBLE, PETSC_COMM_WORLD);
+  s->solveCoarse(y);
+  PetscScalar* Z;
+  CALL( VecGetArray(z, &Z) );
+  for (PetscInt i=0; i < n; ++i)
+    Z[i] += y[s->self];
+  CALL( VecRestoreArray(z, &Z) );
+  return 0;
+}
+
+}
@@ -0,0 +1,42 @@
+#ifndef PE_SCHWARZ_H
+#define PE_SCHWARZ_H
+
+#include <petscksp.h>
+#include <vector>
+
+namespace pe {
+
+/* Two-level additive Schwarz preconditioner
+     M^-1 = sum_p R_p^T A_p^-1 R_p + Z E^-1 Z^T
+   The first level is PETSc's ASM with one subdomain per rank: the nodes
+   of the rank's elements and of the neighbouring elements sharing a
+   vertex with them, restricted to its owned rows. The coarse space
+   Z has one column per rank, the indicator of its owned rows (a
+   partition of unity, Nicolaides), so E = Z^T A Z is a dense P x P
+   matrix that every rank factors redundantly. */
+class TwoLevelSchwarz
+{
+  public:
+    TwoLevelSchwarz(std::vector<long>& subdomain, long first, long last);
+    ~TwoLevelSchwarz();
+    void attach(KSP solver);
+  private:
+    static PetscErrorCode setUpShell(PC pc);
+    static PetscErrorCode applyShell(PC pc, Vec r, Vec z);
+    void setUp(Mat A);
+    void buildCoarse(Mat A);
+    void solveCoarse(std::vector<double>& x);
+    PC local;
+    IS overlapping;
+    IS owned;
+    long first;
+    long last;
+    int peers;
+    int self;
+    std::vector<double> coarse;
+    std::vector<int> pivots;
+};
+
+}
+
+#endif
@@ -0,0 +1,197 @@
+#include "server.h"
+#include "app.h"
+#include "problem.h"
+#include "utils.h"
+#include <PCU.h>
+#include <mpi.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace pe {
+
+static bool endsWith(std::string const& s, const char* suffix)
+{
+  std::string x(suffix);
+  return s.size() > x.size() &&
+         s.compare(s.size() - x.size(), x.size(), x) == 0;
+}
+
+static bool readFile(std::string const& path, std::string& text)
+{
+  FILE* file = std::fopen(path.c_str(), "r");
+  if ( ! file)
+    return false;
+  text.clear();
+  char buf[4096];
+  std::size_t n;
+  while ((n = std::fread(buf, 1, sizeof(buf), file)))
+    text.append(buf, n);
+  std::fclose(file);
+  return true;
+}
+
+// Rank 0 waits for the next request, the name of the first pending
+// <name>.ini not ignored, or returns false on shutdown
+static bool waitForRequest(std::string const& spool,
+    std::set<std::string> const& ignored, std::string& name,
+    std::string& text)
+{
+  std::string stop = spool + "/shutdown";
+  while (true)
+  {
+    if (access(stop.c_str(), F_OK) == 0)
+    {
+      std::remove(stop.c_str());
+      return false;
+    }
+    DIR* dir = opendir(spool.c_str());
+    if ( ! dir)
+      fail("could not open spool directory %s", spool.c_str());
+    std::vector<std::string> names;
+    while (dirent* entry = readdir(dir))
+    {
+      std::string file(entry->d_name);
+      if ( ! endsWith(file, ".ini"))
+        continue;
+      file.erase(file.size() - 4);
+      if ( ! ignored.count(file))
+        names.push_back(file);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (std::size_t i=0; i < names.size(); ++i)
+      if (readFile(spool + "/" + names[i] + ".ini", text))
+      {
+        name = names[i];
+        return true;
+      }
+    usleep(100000);
+  }
+}
+
+// Rank 0's flag for the next request. The other ranks wait here while it
+// polls the spool directory; MPI_Bcast usually spins, which would keep a
+// core per rank busy while the server is idle, so they test and sleep.
+static void broadcastIdle(int& flag)
+{
+  MPI_Request request;
+  MPI_Ibcast(&flag, 1, MPI_INT, 0, MPI_COMM_WORLD, &request);
+  int done = 0;
+  MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+  while ( ! done)
+  {
+    usleep(1000);
+    MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+  }
+}
+
+static void broadcast(std::string& s)
+{
+  int n = s.size();
+  MPI_Bcast(&n, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  s.resize(n);
+  if (n)
+    MPI_Bcast(&s[0], n, MPI_CHAR, 0, MPI_COMM_WORLD);
+}
+
+// Written to a temporary name first so clients never see half a reply.
+// False if the request could not be renamed out of the way.
+static bool reply(std::string const& spool, std::string const& name,
+    std::string const& text)
+{
+  std::string base = spool + "/" + name;
+  std::string tmp = base + ".out.tmp";
+  FILE* file = std::fopen(tmp.c_str(), "w");
+  if ( ! file)
+    fail("could not write %s", tmp.c_str());
+  std::fputs(text.c_str(), file);
+  std::fclose(file);
+  if (std::rename(tmp.c_str(), (base + ".out").c_str()))
+    fail("could not write %s.out", base.c_str());
+  return ! std::rename((base + ".ini").c_str(), (base + ".done").c_str());
+}
+
+// Refuse what would only fail on the first request, before the first solve
+void checkServe(const char* spool)
+{
+  if (getBoolOption("-pe_lean_numbering"))
+    fail("-pe_serve needs the numbering, drop -pe_lean_numbering");
+  if (PCU_Comm_Self())
+    return;
+  DIR* dir = opendir(spool);
+  if ( ! dir)
+    fail("could not open spool directory %s", spool);
+  closedir(dir);
+}
+
+void serve(App& app, Problem const& base, Problem const& current,
+    const char* spool)
+{
+  std::string source = current.rhs.getSource();
+  print("serving requests from %s", spool);
+  std::set<std::string> ignored;
+  int count = 0;
+  while (true)
+  {
+    std::string name;
+    std::string text;
+    int more = 0;
+    if ( ! PCU_Comm_Self())
+      more = waitForRequest(spool, ignored, name, text);
+    broadcastIdle(more);
+    if ( ! more)
+      break;
+    broadcast(name);
+    broadcast(text);
+    double t0 = PCU_Time();
+    Problem next = base;
+    next.output.clear();
+    std::string error;
+    if (next.parse(text, (name + ".ini").c_str(), &error) &&
+        ! next.hasSameOrders(base))
+      error = name + ".ini: fem_order and integration_order are fixed";
+    char buf[1024];
+    std::string result;
+    if (error.empty())
+    {
+      if (next.output.empty())
+        next.output = std::string(spool) + "/" + name;
+      double t1 = PCU_Time();
+      if (next.rhs.getSource() != source)
+      {
+        app.setSource(next.rhs);
+        source = next.rhs.getSource();
+      }
+      double source_time = PCU_Time() - t1;
+      app.update(next.getBoundaryCondition(), next.gNeu, next.gDir,
+          next.output.c_str());
+      App::Timings const& t = app.getTimings();
+      std::snprintf(buf, sizeof(buf),
+          "status = ok\nout = %s\nassemble = %f\nsolve = %f\n"
+          "output = %f\niterations = %d\ntotal = %f\n",
+          next.output.c_str(), source_time + t.assemble, t.solve,
+          t.output, t.iterations, PCU_Time() - t0);
+      result = buf;
+    }
+    else
+    {
+      print("request %s rejected: %s", name.c_str(), error.c_str());
+      result = "status = error\nerror = " + error + "\n";
+    }
+    // a request that stays in place would otherwise be served forever
+    if ( ! PCU_Comm_Self() && ! reply(spool, name, result))
+    {
+      print("could not rename %s.ini, it will be ignored", name.c_str());
+      ignored.insert(name);
+    }
+    ++count;
+  }
+  print("served %d requests", count);
+}
+
+}
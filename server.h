@@ -0,0 +1,25 @@
+#ifndef PE_SERVER_H
+#define PE_SERVER_H
+
+namespace pe {
+
+class App;
+class Problem;
+
+/* Keep the solved app resident and answer requests from a spool
+   directory until a file named "shutdown" appears in it.
+
+   A request is a problem file <name>.ini, read over base, that must keep
+   its finite element and integration orders; current is what the app
+   last solved. Clients should write it under another name and rename it
+   into place. Requests are served in name order: the solution goes to the
+   request's out key (<spool>/<name> by default), then <name>.out gets
+   status, output path, timings and iterations as "key = value" lines and
+   the request is renamed to <name>.done. Collective. */
+void checkServe(const char* spool);
+void serve(App& app, Problem const& base, Problem const& current,
+    const char* spool);
+
+}
+
+#endif
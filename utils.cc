@@ -1,6 +1,7 @@
 #include "utils.h"
 
 #include <PCU.h>
+#include <petscsys.h>
 #include <cstdlib>
 #include <cstdarg>
 
@@ -33,4 +34,45 @@ void failByAssert(const char* cond, const char* file, int line)
   fail("assertion failed: '%s' %s:%i\n", cond, file, line);
 }
 
+// total and largest per-rank bytes sent, collective
+void printTraffic(const char* what, double bytes)
+{
+  double MB = bytes / (1024.0 * 1024.0);
+  double total = MB;
+  double most = MB;
+  PCU_Add_Doubles(&total, 1);
+  PCU_Max_Doubles(&most, 1);
+  print("%s sent %.3f MB, at most %.3f MB from one rank", what, total, most);
+}
+
+// options come from the PETSc database, e.g. PETSC_OPTIONS or .petscrc
+bool getBoolOption(const char* name)
+{
+  PetscBool value = PETSC_FALSE;
+  CALL( PetscOptionsGetBool(PETSC_NULL, PETSC_NULL, name, &value, PETSC_NULL) );
+  return value == PETSC_TRUE;
+}
+
+// false if the option is not set, value is then left alone
+bool getRealOption(const char* name, double& value)
+{
+  PetscReal v;
+  PetscBool set = PETSC_FALSE;
+  CALL( PetscOptionsGetReal(PETSC_NULL, PETSC_NULL, name, &v, &set) );
+  if (set == PETSC_TRUE)
+    value = v;
+  return set == PETSC_TRUE;
+}
+
+// false if the option is not set
+bool getStringOption(const char* name, std::string& value)
+{
+  char buf[PETSC_MAX_PATH_LEN];
+  PetscBool set = PETSC_FALSE;
+  CALL( PetscOptionsGetString(PETSC_NULL, PETSC_NULL, name, buf, sizeof(buf), &set) );
+  if (set == PETSC_TRUE)
+    value = buf;
+  return set == PETSC_TRUE;
+}
+
 }
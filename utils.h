@@ -1,6 +1,8 @@
 #ifndef PE_UTILS_H
 #define PE_UTILS_H
 
+#include <string>
+
 namespace pe {
 
 void print(const char* format, ...)
@@ -9,6 +11,10 @@ void fail(const char* format, ...)
   __attribute__((noreturn, format(printf,1,2)));
 void failByAssert(const char* cond, const char* file, int line)
   __attribute__((noreturn));
+bool getBoolOption(const char* name);
+bool getStringOption(const char* name, std::string& value);
+bool getRealOption(const char* name, double& value);
+void printTraffic(const char* what, double bytes);
 
 }
 